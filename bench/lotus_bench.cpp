@@ -0,0 +1,565 @@
+// lotus_bench: costs of the profiler hot paths, native Linux only.
+// Every result is one (name, value, unit) row, printed as JSON (default) or CSV (--csv), so runs
+// can be diffed and tracked for regressions. Names are stable keys: <benchmark>/<variant>/<parameter>.
+//
+//	lotus_bench [--csv] [--threads N] [--scopes N] [--hwc-recording path]
+
+#include <lotus/profiler.h>
+
+#include <hwcpipe/hwcpipe.h>
+#include <hwcpipe/vendor/arm/mali/hwc_recording.h>
+
+#include <atomic>
+#include <thread>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace lotus
+{
+// the host application owns the main allocator
+linear_allocator_t								e_main_allocator;
+}
+
+using namespace lotus;
+
+static helich::memory_manager					s_memory_manager;
+
+// ---------------------------------------------
+// results
+
+#define BENCH_RESULTS_CAP						256u
+
+struct bench_result_t
+{
+	c8											name[96];
+	f64											value;
+	const_cstr									unit;
+};
+
+static bench_result_t							s_results[BENCH_RESULTS_CAP];
+static u32										s_results_count = 0;
+
+static void _add_result(const_cstr i_unit, const f64 i_value, const_cstr i_format, ...)
+{
+	if (s_results_count >= BENCH_RESULTS_CAP)
+	{
+		return;
+	}
+	bench_result_t& result = s_results[s_results_count];
+	va_list args;
+	va_start(args, i_format);
+	vsnprintf(result.name, sizeof(result.name), i_format, args);
+	va_end(args);
+	result.value = i_value;
+	result.unit = i_unit;
+	s_results_count++;
+	// progress goes to stderr, stdout only carries the report
+	fprintf(stderr, "%-64s %14.3f %s\n", result.name, result.value, result.unit);
+}
+
+static void _print_results(const bool i_csv)
+{
+	const clock_info_t& clockInfo = get_clock_info();
+	if (i_csv)
+	{
+		printf("name,value,unit\n");
+		printf("clock/frequency,%llu,Hz\n", (unsigned long long)clockInfo.frequency);
+		for (u32 i = 0; i < s_results_count; i++)
+		{
+			printf("%s,%.6f,%s\n", s_results[i].name, s_results[i].value, s_results[i].unit);
+		}
+		return;
+	}
+
+	printf("{\n\t\"clock\": { \"source\": %u, \"frequency\": %llu },\n\t\"results\": [\n",
+			(u32)clockInfo.source, (unsigned long long)clockInfo.frequency);
+	for (u32 i = 0; i < s_results_count; i++)
+	{
+		printf("\t\t{ \"name\": \"%s\", \"value\": %.6f, \"unit\": \"%s\" }%s\n", s_results[i].name, s_results[i].value,
+				s_results[i].unit, i + 1 < s_results_count ? "," : "");
+	}
+	printf("\t]\n}\n");
+}
+
+// ---------------------------------------------
+// helpers
+
+static const u64 _now_ns()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static const_cstr _get_storage_name(const storage_mode_e i_storageMode)
+{
+	switch (i_storageMode)
+	{
+		case storage_mode_e::fixed:
+			return "fixed";
+		case storage_mode_e::compact:
+			return "compact";
+		default:
+			return "statistics";
+	}
+}
+
+// thread ids are unique per benchmark, the slot of a thread is looked up by its id
+static const sidx _find_thread_slot(const u32 i_threadId)
+{
+	const u32 slotsCount = get_thread_slots_count();
+	for (u32 i = 0; i < slotsCount; i++)
+	{
+		u32 threadId = 0;
+		const_cstr name = nullptr;
+		if (get_thread_slot_info(i, threadId, name) && threadId == i_threadId)
+		{
+			return (sidx)i;
+		}
+	}
+	return -1;
+}
+
+typedef floral::fixed_array<unpacked_event, linear_allocator_t>	events_array_t;
+
+// every benchmark thread takes a fresh id
+static std::atomic<u32>							s_next_thread_id(1);
+
+// ---------------------------------------------
+// per-scope overhead at several nesting depths
+
+template <u32 t_depth>
+struct nested_scopes_t
+{
+	static void run()
+	{
+		PROFILE_SCOPE("bench/nested");
+		nested_scopes_t<t_depth - 1>::run();
+	}
+};
+
+template <>
+struct nested_scopes_t<0>
+{
+	static void run() { }
+};
+
+template <u32 t_depth>
+static void _bench_scope_depth(const storage_mode_e i_storageMode, const u32 i_scopesCount, events_array_t& io_events)
+{
+	const u32 threadId = s_next_thread_id.fetch_add(1);
+	init_capture_for_this_thread(threadId, "bench/depth", i_storageMode, i_storageMode == storage_mode_e::none);
+	const sidx slotIdx = _find_thread_slot(threadId);
+
+	// batches stay below the ring capacity and are drained outside of the timed region,
+	// so the numbers never include the cheaper drop path
+	const u32 batchIterations = (EVENTS_CAP / 2) / t_depth;
+	const u32 batchesCount = (i_scopesCount / t_depth + batchIterations - 1) / batchIterations;
+	u64 elapsedNs = 0;
+	for (u32 batch = 0; batch < batchesCount; batch++)
+	{
+		const u64 beginNs = _now_ns();
+		for (u32 i = 0; i < batchIterations; i++)
+		{
+			nested_scopes_t<t_depth>::run();
+		}
+		elapsedNs += _now_ns() - beginNs;
+
+		io_events.empty();
+		unpack_capture(io_events, slotIdx);
+	}
+
+	stop_capture_for_this_thread();
+	io_events.empty();
+	unpack_capture(io_events, slotIdx);
+
+	const f64 scopesCount = (f64)batchesCount * batchIterations * t_depth;
+	_add_result("ns/scope", (f64)elapsedNs / scopesCount, "scope_overhead/%s/depth_%u", _get_storage_name(i_storageMode), t_depth);
+}
+
+static void _bench_scope_depths(const u32 i_scopesCount)
+{
+	events_array_t events(EVENTS_CAP, &e_main_allocator);
+	const storage_mode_e storageModes[] = { storage_mode_e::fixed, storage_mode_e::compact, storage_mode_e::none };
+	for (const storage_mode_e storageMode : storageModes)
+	{
+		_bench_scope_depth<1>(storageMode, i_scopesCount, events);
+		_bench_scope_depth<2>(storageMode, i_scopesCount, events);
+		_bench_scope_depth<4>(storageMode, i_scopesCount, events);
+		_bench_scope_depth<8>(storageMode, i_scopesCount, events);
+		_bench_scope_depth<16>(storageMode, i_scopesCount, events);
+	}
+
+	// the floor every scope pays: two clock reads
+	_add_result("ns/read", measure_clock_cost(get_clock_info().source, 1000000), "clock_read/%u", (u32)get_clock_info().source);
+}
+
+// ---------------------------------------------
+// 1..N producers against one concurrent consumer
+
+struct scaling_run_t
+{
+	std::atomic<u32>							ready_count;
+	std::atomic<u32>							done_count;
+	std::atomic<bool>							go;
+	u32											scopes_count;
+	u64											elapsed_ns[THREADS_CAP];
+	u64											dropped_count[THREADS_CAP];
+	u64											consumed_count;
+};
+
+static void _scaling_producer(scaling_run_t& io_run, const u32 i_producerIdx)
+{
+	const u32 threadId = s_next_thread_id.fetch_add(1);
+	init_capture_for_this_thread(threadId, "bench/producer");
+	const sidx slotIdx = _find_thread_slot(threadId);
+
+	io_run.ready_count.fetch_add(1);
+	while (!io_run.go.load(std::memory_order_acquire)) { }
+
+	const u64 beginNs = _now_ns();
+	for (u32 i = 0; i < io_run.scopes_count; i++)
+	{
+		PROFILE_SCOPE("bench/producer");
+	}
+	io_run.elapsed_ns[i_producerIdx] = _now_ns() - beginNs;
+
+	u64 dropped = 0, overwritten = 0;
+	get_thread_slot_overflow_stats((u32)slotIdx, dropped, overwritten);
+	io_run.dropped_count[i_producerIdx] = dropped;
+	stop_capture_for_this_thread();
+	io_run.done_count.fetch_add(1, std::memory_order_release);
+}
+
+static void _scaling_consumer(scaling_run_t& io_run, const u32 i_producersCount, events_array_t& io_events)
+{
+	io_run.consumed_count = 0;
+	bool producersDone = false;
+	while (true)
+	{
+		// one more pass after the producers retired their slots, it recycles them
+		producersDone = io_run.done_count.load(std::memory_order_acquire) == i_producersCount;
+		const u32 slotsCount = get_thread_slots_count();
+		for (u32 i = 0; i < slotsCount; i++)
+		{
+			io_events.empty();
+			unpack_capture(io_events, (sidx)i);
+			io_run.consumed_count += io_events.get_size();
+		}
+		if (producersDone)
+		{
+			break;
+		}
+	}
+}
+
+static void _bench_thread_scaling(const u32 i_maxThreads, const u32 i_scopesCount)
+{
+	static scaling_run_t s_run;
+	// allocated up front, the main allocator is not thread safe
+	events_array_t events(EVENTS_CAP, &e_main_allocator);
+	// powers of two, always ending with the requested maximum
+	u32 producersCount = 1;
+	while (true)
+	{
+		s_run.ready_count.store(0);
+		s_run.done_count.store(0);
+		s_run.go.store(false);
+		s_run.scopes_count = i_scopesCount;
+
+		std::thread consumer(_scaling_consumer, std::ref(s_run), producersCount, std::ref(events));
+		std::thread producers[THREADS_CAP];
+		for (u32 i = 0; i < producersCount; i++)
+		{
+			producers[i] = std::thread(_scaling_producer, std::ref(s_run), i);
+		}
+		while (s_run.ready_count.load() != producersCount) { }
+		const u64 beginNs = _now_ns();
+		s_run.go.store(true, std::memory_order_release);
+		for (u32 i = 0; i < producersCount; i++)
+		{
+			producers[i].join();
+		}
+		const u64 wallNs = _now_ns() - beginNs;
+		consumer.join();
+
+		u64 elapsedNs = 0, dropped = 0;
+		for (u32 i = 0; i < producersCount; i++)
+		{
+			elapsedNs += s_run.elapsed_ns[i];
+			dropped += s_run.dropped_count[i];
+		}
+		const f64 totalScopes = (f64)producersCount * i_scopesCount;
+		_add_result("ns/scope", (f64)elapsedNs / totalScopes, "thread_scaling/per_thread/threads_%u", producersCount);
+		_add_result("Mscopes/s", totalScopes * 1.0e3 / (f64)wallNs, "thread_scaling/aggregate/threads_%u", producersCount);
+		_add_result("%", (f64)dropped * 100.0 / totalScopes, "thread_scaling/dropped/threads_%u", producersCount);
+		_add_result("Mevents/s", (f64)s_run.consumed_count * 1.0e3 / (f64)wallNs, "thread_scaling/consumed/threads_%u", producersCount);
+
+		if (producersCount == i_maxThreads)
+		{
+			break;
+		}
+		producersCount = producersCount * 2 < i_maxThreads ? producersCount * 2 : i_maxThreads;
+	}
+}
+
+// ---------------------------------------------
+// unpack throughput into every floral container, and in place through visit_capture
+
+static const u32								k_unpack_rounds = 256;
+
+// consumes the events in place, like an exporter would
+struct duration_visitor_t {
+	void operator()(const unpacked_event& i_event)
+	{
+		totalTicks += i_event.duration_ticks;
+	}
+
+	u64											totalTicks;
+};
+
+template <typename t_container>
+static void _bench_unpack_into(t_container& io_events, const storage_mode_e i_storageMode, const_cstr i_containerName)
+{
+	const u32 threadId = s_next_thread_id.fetch_add(1);
+	init_capture_for_this_thread(threadId, "bench/unpack", i_storageMode);
+	const sidx slotIdx = _find_thread_slot(threadId);
+
+	// compact blocks hold fewer events than the fixed ring, stay below both
+	const u32 eventsPerRound = EVENTS_CAP / 2;
+	u64 elapsedNs = 0;
+	u64 eventsCount = 0;
+	for (u32 round = 0; round < k_unpack_rounds; round++)
+	{
+		for (u32 i = 0; i < eventsPerRound; i++)
+		{
+			PROFILE_SCOPE("bench/unpack");
+		}
+		const u64 beginNs = _now_ns();
+		unpack_capture(io_events, slotIdx);
+		elapsedNs += _now_ns() - beginNs;
+		eventsCount += eventsPerRound;
+		io_events.empty();
+	}
+	stop_capture_for_this_thread();
+	unpack_capture(io_events, slotIdx);
+	io_events.empty();
+
+	_add_result("ns/event", (f64)elapsedNs / (f64)eventsCount, "unpack/%s/%s", _get_storage_name(i_storageMode), i_containerName);
+}
+
+static void _bench_visit(const storage_mode_e i_storageMode)
+{
+	const u32 threadId = s_next_thread_id.fetch_add(1);
+	init_capture_for_this_thread(threadId, "bench/unpack", i_storageMode);
+	const sidx slotIdx = _find_thread_slot(threadId);
+
+	duration_visitor_t visitor;
+	visitor.totalTicks = 0;
+	const u32 eventsPerRound = EVENTS_CAP / 2;
+	u64 elapsedNs = 0;
+	u64 eventsCount = 0;
+	for (u32 round = 0; round < k_unpack_rounds; round++)
+	{
+		for (u32 i = 0; i < eventsPerRound; i++)
+		{
+			PROFILE_SCOPE("bench/unpack");
+		}
+		const u64 beginNs = _now_ns();
+		visit_capture(slotIdx, visitor);
+		elapsedNs += _now_ns() - beginNs;
+		eventsCount += eventsPerRound;
+	}
+	stop_capture_for_this_thread();
+	visit_capture(slotIdx, visitor);
+
+	_add_result("ns/event", (f64)elapsedNs / (f64)eventsCount, "unpack/%s/visitor", _get_storage_name(i_storageMode));
+}
+
+static void _bench_unpack()
+{
+	events_array_t fixedArray(EVENTS_CAP, &e_main_allocator);
+	floral::fast_fixed_array<unpacked_event, linear_allocator_t> fastFixedArray(EVENTS_CAP, &e_main_allocator);
+	floral::ring_buffer_st<unpacked_event, linear_allocator_t, EVENTS_CAP> ringBuffer(&e_main_allocator);
+	floral::fast_ring_buffer_st<unpacked_event, linear_allocator_t, EVENTS_CAP> fastRingBuffer(&e_main_allocator);
+
+	const storage_mode_e storageModes[] = { storage_mode_e::fixed, storage_mode_e::compact };
+	for (const storage_mode_e storageMode : storageModes)
+	{
+		_bench_unpack_into(fixedArray, storageMode, "fixed_array");
+		_bench_unpack_into(fastFixedArray, storageMode, "fast_fixed_array");
+		_bench_unpack_into(ringBuffer, storageMode, "ring_buffer_st");
+		_bench_unpack_into(fastRingBuffer, storageMode, "fast_ring_buffer_st");
+		_bench_visit(storageMode);
+	}
+}
+
+// ---------------------------------------------
+// counter sampling against recorded hwcnt dumps
+
+// a Mali-G71 (TMIx) with 4 cores and 2 L2 slices, every counter grows by one per dump
+static const bool _write_synthetic_recording(c8* o_path, const size i_pathSize)
+{
+	snprintf(o_path, i_pathSize, "/tmp/lotus_bench_XXXXXX");
+	const int fd = mkstemp(o_path);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	static const u32 k_samplesCount = 64;
+	static const u32 k_bufferSize = 64 * 256;								// 64 blocks of 64 counters
+	hwcpipe::hwc_recording_header_t header;
+	memset(&header, 0, sizeof(header));
+	header.magic = hwcpipe::k_hwcRecordingMagic;
+	header.version = hwcpipe::k_hwcRecordingVersion;
+	header.gpu_id = 0x6000;
+	header.hw_version = 5;
+	header.core_mask = 0xf;
+	header.l2_slices = 2;
+	header.buffer_size = k_bufferSize;
+	header.samples_count = k_samplesCount;
+	bool written = write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header);
+
+	static u32 s_dump[k_bufferSize / sizeof(u32)];
+	for (u32 sample = 0; sample < k_samplesCount && written; sample++)
+	{
+		const u64 timeStamp = (u64)sample * 1000000ull;
+		for (u32 i = 0; i < k_bufferSize / sizeof(u32); i++)
+		{
+			s_dump[i] = sample + 1;
+		}
+		written = write(fd, &timeStamp, sizeof(timeStamp)) == (ssize_t)sizeof(timeStamp)
+			&& write(fd, s_dump, k_bufferSize) == (ssize_t)k_bufferSize;
+	}
+	close(fd);
+	return written;
+}
+
+static void _bench_counter_sampling(const_cstr i_recordingPath)
+{
+	c8 syntheticPath[64] = {};
+	if (i_recordingPath == nullptr)
+	{
+		if (!_write_synthetic_recording(syntheticPath, sizeof(syntheticPath)))
+		{
+			fprintf(stderr, "could not write a hwcnt recording, skipping counter sampling\n");
+			return;
+		}
+		i_recordingPath = syntheticPath;
+	}
+
+	hwcpipe::use_recorded_dumps(i_recordingPath);
+	const bool ready = init_hardware_counters(k_default_hardware_counters);
+	if (syntheticPath[0] != 0)
+	{
+		// mapped by now
+		unlink(syntheticPath);
+	}
+	if (!ready)
+	{
+		fprintf(stderr, "could not replay %s, skipping counter sampling\n", i_recordingPath);
+		hwcpipe::use_recorded_dumps(nullptr);
+		return;
+	}
+
+	static const u32 k_samplesCount = 100000;
+	hardware_counters_t counters;
+	u64 beginNs = _now_ns();
+	for (u32 i = 0; i < k_samplesCount; i++)
+	{
+		capture_counters_into(counters);
+	}
+	_add_result("ns/sample", (f64)(_now_ns() - beginNs) / k_samplesCount, "counters/synchronous/struct");
+
+	hardware_counters_store_t* store = create_hardware_counters_store(get_enabled_hardware_counters());
+	u32 appendedCount = 0;
+	u64 elapsedNs = 0;
+	while (appendedCount < k_samplesCount)
+	{
+		beginNs = _now_ns();
+		u32 batchCount = 0;
+		for (; batchCount < COUNTERS_CHUNK_SAMPLES * 16 && capture_counters_into(*store); batchCount++) { }
+		elapsedNs += _now_ns() - beginNs;
+		appendedCount += batchCount;
+		reset_hardware_counters_store(*store);
+	}
+	_add_result("ns/sample", (f64)elapsedNs / appendedCount, "counters/synchronous/store");
+
+	// with the sampler thread running, the hot path only peeks at its latest sample
+	if (start_gpu_sampler(1000))
+	{
+		beginNs = _now_ns();
+		for (u32 i = 0; i < k_samplesCount; i++)
+		{
+			capture_counters_into(counters);
+		}
+		_add_result("ns/sample", (f64)(_now_ns() - beginNs) / k_samplesCount, "counters/sampler/struct");
+		stop_gpu_sampler();
+	}
+
+	stop_hardware_counters();
+	hwcpipe::use_recorded_dumps(nullptr);
+}
+
+// ---------------------------------------------
+
+int main(int argc, char** argv)
+{
+	bool csv = false;
+	u32 maxThreads = std::thread::hardware_concurrency();
+	u32 scopesCount = 1000000;
+	const_cstr recordingPath = nullptr;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--csv") == 0)
+		{
+			csv = true;
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			maxThreads = (u32)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--scopes") == 0 && i + 1 < argc)
+		{
+			scopesCount = (u32)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--hwc-recording") == 0 && i + 1 < argc)
+		{
+			recordingPath = argv[++i];
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [--csv] [--threads N] [--scopes N] [--hwc-recording path]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (maxThreads == 0)
+	{
+		maxThreads = 1;
+	}
+	// the consumer takes a slot as well
+	if (maxThreads > THREADS_CAP - 1)
+	{
+		maxThreads = THREADS_CAP - 1;
+	}
+
+	s_memory_manager.initialize(
+			helich::memory_region<linear_allocator_t>{ "lotus/main", SIZE_MB(512), &e_main_allocator });
+
+	set_clock_source(is_clock_source_available(clock_source_e::cpu_counter) ?
+			clock_source_e::cpu_counter : clock_source_e::monotonic_raw);
+
+	_bench_scope_depths(scopesCount);
+	_bench_thread_scaling(maxThreads, scopesCount);
+	_bench_unpack();
+	_bench_counter_sampling(recordingPath);
+
+	_print_results(csv);
+	return 0;
+}
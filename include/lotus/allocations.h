@@ -0,0 +1,122 @@
+#pragma once
+
+#include <floral.h>
+
+#include <new>
+#include <stdlib.h>
+#include <malloc.h>
+
+#include "names.h"
+
+namespace lotus {
+
+	// allocation events go into the calling thread's event ring (kind allocation / free, see
+	// unpacked_event) and, when the thread aggregates statistics, into the statistics of the
+	// innermost open scope. Threads that do not capture ignore them.
+	// Allocator ids share the name registry.
+	inline const u32							register_allocator(const_cstr i_name) { return register_name(i_name); }
+	void										record_allocation(const u32 i_allocatorId, const u64 i_size);
+	void										record_free(const u32 i_allocatorId, const u64 i_size);
+
+	// -----------------------------------------
+	// wraps a helich allocator (or anything with allocate(bytes) / free(ptr)): every block carries
+	// a small header with its size so that frees are recorded with their size too
+	template <typename t_allocator>
+	struct tracked_allocator_t {
+		static constexpr size					k_header_size = 16;						// keeps the 16-byte alignment of the wrapped allocator
+
+		tracked_allocator_t(t_allocator* i_allocator, const_cstr i_name)
+			: allocator(i_allocator)
+			, allocator_id(register_allocator(i_name))
+		{ }
+
+		void* allocate(const size i_bytes)
+		{
+			u8* block = (u8*)allocator->allocate(i_bytes + k_header_size);
+			if (block == nullptr) {
+				return nullptr;
+			}
+			*(size*)block = i_bytes;
+			record_allocation(allocator_id, i_bytes);
+			return block + k_header_size;
+		}
+
+		template <typename t_type, typename... t_args>
+		t_type* allocate(t_args&&... i_args)
+		{
+			void* data = allocate(sizeof(t_type));
+			return data ? new (data) t_type(static_cast<t_args&&>(i_args)...) : nullptr;
+		}
+
+		template <typename t_type>
+		t_type* allocate_array(const size i_count)
+		{
+			t_type* data = (t_type*)allocate(sizeof(t_type) * i_count);
+			for (size i = 0; data && i < i_count; i++) {
+				new (&data[i]) t_type();
+			}
+			return data;
+		}
+
+		void free(void* i_data)
+		{
+			if (i_data == nullptr) {
+				return;
+			}
+			u8* block = (u8*)i_data - k_header_size;
+			record_free(allocator_id, *(size*)block);
+			allocator->free(block);
+		}
+
+		t_allocator*							allocator;
+		u32										allocator_id;
+	};
+
+	// -----------------------------------------
+	// the global hook: call these from the application's own malloc / new wrappers, or use
+	// LOTUS_DEFINE_GLOBAL_ALLOCATION_HOOKS. Sizes are the usable sizes reported by the C runtime,
+	// so allocations and frees match.
+	const u32									get_global_allocator_id();
+
+	inline void* tracked_malloc(const size i_bytes)
+	{
+		void* data = malloc(i_bytes);
+		if (data) {
+#if defined(PLATFORM_WINDOWS)
+			record_allocation(get_global_allocator_id(), _msize(data));
+#else
+			record_allocation(get_global_allocator_id(), malloc_usable_size(data));
+#endif
+		}
+		return data;
+	}
+
+	inline void tracked_free(void* i_data)
+	{
+		if (i_data) {
+#if defined(PLATFORM_WINDOWS)
+			record_free(get_global_allocator_id(), _msize(i_data));
+#else
+			record_free(get_global_allocator_id(), malloc_usable_size(i_data));
+#endif
+			free(i_data);
+		}
+	}
+
+}
+
+// replaces the global new / delete of the application, to be used in exactly one source file
+#define LOTUS_DEFINE_GLOBAL_ALLOCATION_HOOKS()												\
+	void* operator new(size_t i_bytes) {												\
+		void* data = lotus::tracked_malloc(i_bytes ? i_bytes : 1);						\
+		if (data == nullptr) { throw std::bad_alloc(); }								\
+		return data; }																	\
+	void* operator new[](size_t i_bytes) { return operator new(i_bytes); }				\
+	void* operator new(size_t i_bytes, const std::nothrow_t&) noexcept {				\
+		return lotus::tracked_malloc(i_bytes ? i_bytes : 1); }							\
+	void* operator new[](size_t i_bytes, const std::nothrow_t&) noexcept {				\
+		return lotus::tracked_malloc(i_bytes ? i_bytes : 1); }							\
+	void operator delete(void* i_data) noexcept { lotus::tracked_free(i_data); }		\
+	void operator delete[](void* i_data) noexcept { lotus::tracked_free(i_data); }		\
+	void operator delete(void* i_data, size_t) noexcept { lotus::tracked_free(i_data); }	\
+	void operator delete[](void* i_data, size_t) noexcept { lotus::tracked_free(i_data); }
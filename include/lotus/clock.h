@@ -0,0 +1,38 @@
+#pragma once
+
+#include <floral.h>
+
+namespace lotus {
+
+	enum class clock_source_e : u32 {
+		monotonic_raw = 0,						// clock_gettime(CLOCK_MONOTONIC_RAW), ticks are nanoseconds
+		cpu_counter,							// rdtsc (x86-64) / cntvct_el0 (arm64), calibrated
+		performance_counter,					// QueryPerformanceCounter
+		count
+	};
+
+	struct clock_info_t {
+		clock_source_e							source;
+		u64										frequency;	// ticks per second
+		f64										ns_per_tick;
+		f64										ms_per_tick;
+	};
+
+	// the clock source must be selected before any thread starts capturing
+	const bool									set_clock_source(const clock_source_e i_source);
+	const bool									is_clock_source_available(const clock_source_e i_source);
+	const clock_info_t&							get_clock_info();
+
+	// measures the tick frequency of the current source against CLOCK_MONOTONIC_RAW / QPC
+	const u64									calibrate_clock(const u32 i_durationMs);
+
+	// microbenchmark: average cost in nanoseconds of one raw read of the given source
+	// (a profile scope pays two of them)
+	const f64									measure_clock_cost(const clock_source_e i_source, const u32 i_iterations);
+
+	const f64									ticks_to_ns(const u64 i_ticks);
+	const f64									ticks_to_ms(const u64 i_ticks);
+
+}
+
+#include "lotus/detail/clock.h"
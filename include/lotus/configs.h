@@ -5,4 +5,37 @@
 #define SAVED_CAPTURES							3
 #define SAVED_EVENTS_COUNT						1024
 #define EVENTS_CAP								4096u
-#define THREADS_CAP								8u
+#define THREADS_CAP								256u
+#define THREAD_SLOTS_PER_CHUNK					8u
+#define CACHE_LINE_SIZE							64
+#define NAMES_CAP								1024u
+#define COMPACT_BLOCK_SIZE						4096u
+#define COMPACT_BLOCKS_CAP						32u
+// an overwriting producer that laps its consumer reloads the consumer position once per this many
+// events only, power of two
+#define OVERWRITE_RECHECK_EVENTS				64u
+
+// scopes whose category bits are not in this mask are compiled out entirely
+#ifndef COMPILED_CATEGORIES
+#define COMPILED_CATEGORIES						0xffffffffu
+#endif
+
+#define STATISTICS_ENTRIES_CAP					256u
+#define HISTOGRAM_SUB_BUCKET_BITS				3u
+
+#define TRIGGER_DUMP_EVENTS_CAP					16384u
+#define GPU_SAMPLES_CAP							1024u
+#define COUNTERS_CHUNK_SAMPLES					1024u
+#define COUNTERS_CHUNKS_CAP						256u
+// CPU counters opened per thread, a perf_event group larger than the PMU is never scheduled
+#define CPU_COUNTERS_CAP						4u
+// innermost scopes remembered per thread for attributing allocations
+#define ALLOCATION_SCOPES_CAP					64u
+// async spans and flow links waiting for their other half while unpacking, power of two
+#define FLOWS_CAP								4096u
+// timeline merges: events held per merge (all threads), windows merged in parallel, worker threads,
+// and the event count below which a merge stays on the calling thread
+#define MERGE_EVENTS_CAP						32768u
+#define MERGE_WINDOWS_CAP						64u
+#define MERGE_WORKERS_CAP						8u
+#define MERGE_PARALLEL_EVENTS					16384u
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <floral.h>
+
+#include "configs.h"
+#include "events.h"
+
+namespace lotus {
+
+	// per-thread CPU counters (Linux perf_event), read by counted scopes at begin and end, see
+	// PROFILE_SCOPE_COUNTED. At most CPU_COUNTERS_CAP counters of i_counterMask are opened.
+	// Hardware counters count user space only, counters the PMU does not support are skipped.
+	// Software counters that perf_event_open refuses (perf_event_paranoid, seccomp) are read
+	// through getrusage(RUSAGE_THREAD) instead, except cpu_migrations: task_clock then comes from
+	// the user + system times of the thread, as coarse as the kernel's CPU time accounting.
+	// Reopening replaces the previous set, stop_capture_for_this_thread closes them.
+	const bool									init_cpu_counters_for_this_thread(const u32 i_counterMask = k_default_cpu_counters);
+	void										stop_cpu_counters_for_this_thread();
+	// the set actually opened, 0 when perf_event is not available
+	const u32									get_cpu_counters_for_this_thread();
+	// true when the hardware counters are read in user space (rdpmc / cntr registers through the
+	// perf mmap page), otherwise every counted scope costs two read() syscalls. Software counters
+	// always cost two syscalls, use them on coarse scopes such as frames.
+	const bool									are_cpu_counters_read_in_user_space();
+
+}
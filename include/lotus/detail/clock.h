@@ -0,0 +1,65 @@
+#pragma once
+
+#include <floral.h>
+
+#if defined(PLATFORM_WINDOWS)
+#include <intrin.h>
+#else
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+namespace lotus {
+namespace detail {
+
+	extern clock_info_t							s_clock_info;
+
+	const u64									read_performance_counter();
+
+	inline const u64 read_monotonic_raw()
+	{
+#if defined(PLATFORM_WINDOWS)
+		return read_performance_counter();
+#else
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+		return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+#endif
+	}
+
+	inline const u64 read_cpu_counter()
+	{
+#if defined(_M_X64) || defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#elif defined(__aarch64__)
+		u64 ticks;
+		asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+		return ticks;
+#else
+		return read_monotonic_raw();
+#endif
+	}
+
+	inline const u64 read_clock(const clock_source_e i_source)
+	{
+		switch (i_source)
+		{
+			case clock_source_e::cpu_counter:
+				return read_cpu_counter();
+			case clock_source_e::performance_counter:
+				return read_performance_counter();
+			default:
+				return read_monotonic_raw();
+		}
+	}
+
+	// hot path: raw ticks only, conversion happens when the capture is unpacked
+	inline const u64 read_clock()
+	{
+		return read_clock(s_clock_info.source);
+	}
+
+}
+}
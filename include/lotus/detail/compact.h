@@ -0,0 +1,231 @@
+#pragma once
+
+#include <floral.h>
+
+#include <atomic>
+
+#include "lotus/configs.h"
+#include "lotus/events.h"
+#include "lotus/clock.h"
+#include "lotus/names.h"
+#include "lotus/detail/cpu_counters.h"
+
+namespace lotus {
+namespace detail {
+
+	static_assert((COMPACT_BLOCKS_CAP & (COMPACT_BLOCKS_CAP - 1)) == 0, "COMPACT_BLOCKS_CAP must be a power of two");
+
+	// name id, zigzag time stamp delta, duration, depth << 6 | kind << 2 | counted << 1 | weighted,
+	// [weight], [counter mask, counter deltas]: all varints.
+	// Plot records: name id, zigzag time stamp delta, value, kind << 2 | is_double, where the value
+	// is a zigzag integer unless is_double, then it is the bit pattern of the f64
+	constexpr u32 get_varint_max_size(const u32 i_bits)
+	{
+		return (i_bits + 6) / 7;
+	}
+
+	static constexpr u32 k_compact_record_max_size =
+		get_varint_max_size(32)																// name id
+		+ get_varint_max_size(64)															// time stamp delta
+		+ get_varint_max_size(64)															// duration or plot value
+		+ get_varint_max_size(32 + 6)														// u32 depth and the flags
+		+ get_varint_max_size(32)															// weight
+		+ get_varint_max_size(32)															// counter mask
+		+ get_varint_max_size(64) * CPU_COUNTERS_CAP;
+
+	struct compact_block_t {
+		std::atomic<u32>						committed;							// bytes published to the consumer
+		u32										padding;
+		u64										base_time_stamp;									// the first delta of the block is taken against this
+		u8										data[COMPACT_BLOCK_SIZE - 16];
+	};
+
+	// single producer / single consumer ring of blocks: blocks before wblock are sealed,
+	// wblock itself is being appended to and can be read up to its committed size
+	struct compact_event_buffer_t {
+		// producer side
+		alignas(CACHE_LINE_SIZE) std::atomic<u64>	wblock;
+		u64										cached_rblock;
+		u32										woffset;
+		u64										wprev_time_stamp;
+		u64										wpin_end;								// trigger pin the block to reuse was found to hold
+
+		// consumer side
+		alignas(CACHE_LINE_SIZE) std::atomic<u64>	rblock;
+		u32										roffset;
+		u64										rprev_time_stamp;
+
+		compact_block_t*						blocks;
+	};
+
+	// allocation records reuse the duration and weight fields for the size and the allocator,
+	// plot records the duration field for the bit pattern of the value, async and flow records for the id,
+	// lock wait records the weight for the owner thread
+	inline void apply_event_kind(const event_kind_e i_kind, unpacked_event& io_event)
+	{
+		io_event.kind = i_kind;
+		io_event.size = 0;
+		io_event.allocator_id = k_invalid_name_id;
+		io_event.allocator_name = nullptr;
+		io_event.value = 0.0;
+		io_event.id = 0;
+		io_event.owner_thread_id = 0;
+		switch (i_kind) {
+			case event_kind_e::scope:
+			case event_kind_e::lock_hold:
+				return;
+			case event_kind_e::lock_wait:
+				io_event.owner_thread_id = io_event.weight;
+				io_event.weight = 1;
+				return;
+			case event_kind_e::allocation:
+			case event_kind_e::free:
+				io_event.size = io_event.duration_ticks;
+				io_event.allocator_id = io_event.weight;
+				io_event.allocator_name = get_name(io_event.weight);
+				break;
+			case event_kind_e::plot:
+				memcpy(&io_event.value, &io_event.duration_ticks, sizeof(f64));
+				break;
+			default:
+				// async and flow
+				io_event.id = io_event.duration_ticks;
+				break;
+		}
+		io_event.duration_ticks = 0;
+		io_event.duration_ms = 0.0;
+		io_event.weight = 1;
+	}
+
+	inline u8* write_varint(u8* o_data, u64 i_value)
+	{
+		while (i_value >= 0x80)
+		{
+			*o_data++ = (u8)(i_value | 0x80);
+			i_value >>= 7;
+		}
+		*o_data++ = (u8)i_value;
+		return o_data;
+	}
+
+	inline const u8* read_varint(const u8* i_data, u64& o_value)
+	{
+		u64 value = 0;
+		u32 shift = 0;
+		while (*i_data & 0x80)
+		{
+			value |= (u64)(*i_data++ & 0x7f) << shift;
+			shift += 7;
+		}
+		value |= (u64)(*i_data++) << shift;
+		o_value = value;
+		return i_data;
+	}
+
+	inline const u64 zigzag_encode(const s64 i_value)
+	{
+		return ((u64)i_value << 1) ^ (u64)(i_value >> 63);
+	}
+
+	inline const s64 zigzag_decode(const u64 i_value)
+	{
+		return (s64)(i_value >> 1) ^ -(s64)(i_value & 1);
+	}
+
+	// decodes the record at i_data, its time stamp delta is taken against io_prevTimeStamp.
+	// Returns the first byte past the record.
+	inline const u8* read_compact_record(const u8* i_data, u64& io_prevTimeStamp, unpacked_event& o_event)
+	{
+		const u8* p = i_data;
+		u64 nameId, tsDelta, duration, depth, weight = 1;
+		p = read_varint(p, nameId);
+		p = read_varint(p, tsDelta);
+		p = read_varint(p, duration);
+		p = read_varint(p, depth);
+		const event_kind_e kind = (event_kind_e)((depth >> 2) & k_event_kind_mask);
+		u64 counterMask = 0;
+		u64 counters[CPU_COUNTERS_CAP];
+		if (kind == event_kind_e::plot) {
+			if ((depth & 1) == 0) {
+				const f64 value = (f64)zigzag_decode(duration);
+				memcpy(&duration, &value, sizeof(f64));
+			}
+		} else if (depth & 1) {
+			p = read_varint(p, weight);
+		}
+		if (kind != event_kind_e::plot && (depth & 2)) {
+			p = read_varint(p, counterMask);
+			u32 countersCount = 0;
+			for (u64 mask = counterMask; mask != 0 && countersCount < CPU_COUNTERS_CAP; mask &= mask - 1) {
+				p = read_varint(p, counters[countersCount++]);
+			}
+		}
+
+		o_event.time_stamp = io_prevTimeStamp + (u64)zigzag_decode(tsDelta);
+		o_event.duration_ticks = duration;
+		o_event.duration_ms = ticks_to_ms(duration);
+		o_event.depth = (u32)(depth >> 6);
+		o_event.name_id = (u32)nameId;
+		o_event.weight = (u32)weight;
+		o_event.name = get_name((u32)nameId);
+		apply_event_kind(kind, o_event);
+		unpack_cpu_counters((u32)counterMask, counters, o_event);
+		io_prevTimeStamp = o_event.time_stamp;
+		return p;
+	}
+
+	// decodes i_size bytes of a block (a copy or a block the caller owns) without touching the ring
+	// positions, the records are handed to i_visitor(const unpacked_event&) in completion order
+	template <typename t_visitor>
+	void visit_compact_block(const u8* i_data, const u32 i_size, const u64 i_baseTimeStamp, t_visitor& i_visitor)
+	{
+		u64 prevTimeStamp = i_baseTimeStamp;
+		for (const u8* p = i_data; p < i_data + i_size; ) {
+			unpacked_event eve;
+			p = read_compact_record(p, prevTimeStamp, eve);
+			i_visitor(eve);
+		}
+	}
+
+	// decodes what the producer has published so far, i_maxEvents records at most, they are handed
+	// to i_visitor(const unpacked_event&) in completion order. Returns the number of records.
+	template <typename t_visitor>
+	const u32 visit_compact_events(compact_event_buffer_t& i_buffer, t_visitor& i_visitor, const u32 i_maxEvents)
+	{
+		u64 rblock = i_buffer.rblock.load(std::memory_order_relaxed);
+		u32 count = 0;
+		while (true) {
+			compact_block_t& block = i_buffer.blocks[rblock & (COMPACT_BLOCKS_CAP - 1)];
+			const bool sealed = rblock < i_buffer.wblock.load(std::memory_order_acquire);
+			const u32 committed = block.committed.load(std::memory_order_acquire);
+			if (i_buffer.roffset == 0 && committed > 0) {
+				i_buffer.rprev_time_stamp = block.base_time_stamp;
+			}
+
+			const u8* p = block.data + i_buffer.roffset;
+			const u8* end = block.data + committed;
+			while (p < end) {
+				if (count == i_maxEvents) {
+					// the rest of the block comes with the next visit
+					i_buffer.roffset = (u32)(p - block.data);
+					return count;
+				}
+				unpacked_event eve;
+				p = read_compact_record(p, i_buffer.rprev_time_stamp, eve);
+				i_visitor(eve);
+				count++;
+			}
+			i_buffer.roffset = committed;
+
+			if (!sealed) {
+				return count;
+			}
+			// a sealed block never grows again, hand it back to the producer
+			rblock++;
+			i_buffer.roffset = 0;
+			i_buffer.rblock.store(rblock, std::memory_order_release);
+		}
+	}
+
+}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <floral.h>
+
+#include "lotus/configs.h"
+#include "lotus/events.h"
+
+namespace lotus {
+namespace detail {
+
+	// the side record of a counted event, stored in a ring parallel to the event slots
+	struct cpu_counters_record_t {
+		u32										mask;
+		u32										padding;
+		u64										values[CPU_COUNTERS_CAP];				// ascending counter order
+	};
+
+	// thread local data. The perf counters form up to two groups, hardware then software, so that
+	// the software ones keep counting when the PMU cannot schedule the hardware group: fds[0] and
+	// fds[hardware_count] are the leaders.
+	struct cpu_counters_info_t {
+		u32										mask;
+		u32										count;
+		u32										rusage_mask;							// read through getrusage, perf_event_open refused them
+		u32										perf_count;
+		u32										hardware_count;
+		bool									user_space_read;						// of the hardware group
+		u8										value_indices[CPU_COUNTERS_CAP];		// of each perf counter in the read values
+		s32										fds[CPU_COUNTERS_CAP];
+		void*									pages[CPU_COUNTERS_CAP];				// perf_event_mmap_page
+	};
+
+	extern thread_local cpu_counters_info_t		s_cpu_counters_info;
+
+	// hot path: o_values receives s_cpu_counters_info.count values
+	void										read_cpu_counters(u64* o_values);
+
+	inline void unpack_cpu_counters(const u32 i_mask, const u64* i_values, unpacked_event& o_event)
+	{
+		o_event.cpu_counter_mask = i_mask;
+		u32 valueIdx = 0;
+		for (u32 i = 0; i < (u32)cpu_counter_e::count; i++) {
+			o_event.cpu_counters[i] = (i_mask & (1u << i)) ? i_values[valueIdx++] : 0;
+		}
+	}
+
+}
+}
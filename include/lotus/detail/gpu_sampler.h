@@ -0,0 +1,44 @@
+#pragma once
+
+#include <floral.h>
+
+#include <atomic>
+
+#include "lotus/configs.h"
+#include "lotus/events.h"
+
+namespace lotus {
+namespace detail {
+
+	static_assert((GPU_SAMPLES_CAP & (GPU_SAMPLES_CAP - 1)) == 0, "GPU_SAMPLES_CAP must be a power of two");
+
+	// same publication protocol as event_slot_t
+	struct gpu_sample_slot_t {
+		std::atomic<u64>						sequence;
+		gpu_counters_sample_t					data;
+	};
+
+	// single producer (the sampler thread) / single consumer (drain_gpu_samples) ring, the trigger
+	// and capture_counters_into additionally peek at it without consuming. The producer always
+	// overwrites the oldest slot so that the peekers see fresh samples, the consumer catches up.
+	struct gpu_sample_ring_t {
+		// producer side
+		alignas(CACHE_LINE_SIZE) std::atomic<u64>	widx;
+		std::atomic<u64>						dropped_count;
+
+		// consumer side
+		alignas(CACHE_LINE_SIZE) std::atomic<u64>	ridx;
+
+		alignas(CACHE_LINE_SIZE) gpu_sample_slot_t	slots[GPU_SAMPLES_CAP];
+	};
+
+	// dumps the hardware counters synchronously, defined next to the hwcpipe setup
+	void										sample_hardware_counters(gpu_counters_sample_t& o_sample);
+
+	const bool									peek_latest_gpu_sample(gpu_counters_sample_t& o_sample);
+	// copies the retained samples taken in [i_beginTimeStamp, i_endTimeStamp], oldest first
+	const u32									peek_gpu_samples(const u64 i_beginTimeStamp, const u64 i_endTimeStamp,
+													gpu_counters_sample_t* o_samples, const u32 i_capacity);
+
+}
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <floral.h>
+
+#include "lotus/events.h"
+#include "lotus/detail/profiler.h"
+
+namespace lotus {
+namespace detail {
+
+	// calling thread's id as given to init_capture_for_this_thread, 0 when it does not capture
+	inline const u32 get_capture_thread_id()
+	{
+		return s_capture_info.thread_id;
+	}
+
+	// writes a lock_wait / lock_hold record covering [i_timeStamp, i_timeStamp + i_durationTicks]
+	// into the calling thread's event ring, one level below the innermost open scope
+	void										record_lock_event(const event_kind_e i_kind, const u32 i_lockId,
+													const u64 i_timeStamp, const u64 i_durationTicks, const u32 i_ownerThreadId);
+
+}
+}
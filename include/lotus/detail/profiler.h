@@ -2,20 +2,112 @@
 
 #include <floral.h>
 
+#include <atomic>
+
+#include <floral/thread/mutex.h>
+
 #include "lotus/configs.h"
 #include "lotus/memory.h"
 #include "lotus/events.h"
+#include "lotus/clock.h"
+#include "lotus/names.h"
+#include "lotus/detail/compact.h"
+#include "lotus/detail/cpu_counters.h"
+#include "lotus/detail/statistics.h"
+#include "lotus/detail/trigger.h"
 
 namespace lotus {
 namespace detail {
 
+	static_assert((EVENTS_CAP & (EVENTS_CAP - 1)) == 0, "EVENTS_CAP must be a power of two");
+	static_assert(NAMES_CAP <= 65536u, "name ids are stored on 16 bits in event records");
+
+	// what the hot path writes: names are stored as registry ids and resolved when unpacked,
+	// packed so that a slot stays 32 bytes. The top bits of depth hold the counted flag and the
+	// event_kind_e, allocation records store the size as duration and the allocator as weight.
+	struct event_record_t {
+		u64										time_stamp;
+		u64										duration_ticks;
+		u16										name_id;
+		u16										depth;
+		u32										weight;
+	};
+
+	static constexpr u16 k_counted_depth_bit = 0x8000;
+	static constexpr u32 k_kind_depth_shift = 11;
+	static constexpr u16 k_depth_mask = (1u << k_kind_depth_shift) - 1;
+
+	// a slot is published once its sequence equals its write position + 1
+	struct event_slot_t {
+		std::atomic<u64>						sequence;
+		event_record_t							data;
+	};
+
+	// wait-free single producer (the owning thread) / single consumer (unpack_capture) ring,
+	// positions only ever increase and are masked into the slot array.
+	// A slot is invalidated before it is reused, so a reader still copying its previous event
+	// rejects the copy. With overflow_policy_e::overwrite_oldest the producer never waits for the
+	// consumer, the consumer notices it has been lapped by comparing its read position with widx.
 	struct unpacked_event_buffer_t {
-		floral::mutex							mtx;
-		unpacked_event*							data;
-		sidx									ridx, widx;
+		// producer side
+		alignas(CACHE_LINE_SIZE) std::atomic<u64>	widx;
+		u64										cached_ridx;
+		overflow_policy_e						overflow_policy;
+		// only written by the producer, read from anywhere
+		std::atomic<u64>						dropped_count;
+		std::atomic<u64>						overwritten_count;
+
+		// consumer side
+		alignas(CACHE_LINE_SIZE) std::atomic<u64>	ridx;
+
+		alignas(CACHE_LINE_SIZE) event_slot_t*	data;
+		cpu_counters_record_t*					counters;								// parallel to data, once the thread opened CPU counters
+		storage_mode_e							storage_mode;
+
+		compact_event_buffer_t					compact;								// only used in storage_mode_e::compact
+	};
+
+	// allocates the side ring of counted events for a fixed-storage buffer, once. With s_init_mtx held
+	void										ensure_cpu_counters_records(unpacked_event_buffer_t& io_buffer);
+
+	static_assert(THREADS_CAP % THREAD_SLOTS_PER_CHUNK == 0, "THREADS_CAP must be a multiple of THREAD_SLOTS_PER_CHUNK");
+
+	enum class thread_slot_state_e : u32 {
+		free = 0,
+		live,																			// owned by a capturing thread
+		retired																			// thread stopped, waiting for the consumer to drain it
 	};
 
-	extern unpacked_event_buffer_t				s_unpacked_event_buffers[THREADS_CAP];
+	// per-thread control block, never freed so consumers can walk the registry without locking,
+	// a retired slot goes back to the free list only once the consumer has drained it
+	struct thread_slot_t {
+		unpacked_event_buffer_t					buffer;
+		std::atomic<u32>						enabled_categories;						// written from any thread, read by the owner
+		std::atomic<scope_statistics_table_t*>	statistics;								// allocated once, reset when the slot is claimed
+		std::atomic<u32>						state;
+		std::atomic<u32>						generation;
+		u32										thread_id;
+		c8										name[CAPTURE_NAME_LENGTH];
+	};
+
+	struct thread_slot_chunk_t {
+		thread_slot_t							slots[THREAD_SLOTS_PER_CHUNK];
+	};
+
+	extern std::atomic<thread_slot_chunk_t*>	s_thread_slot_chunks[THREADS_CAP / THREAD_SLOTS_PER_CHUNK];
+	extern std::atomic<u32>						s_thread_slots_count;
+	// guards the thread slots (claiming, recycling) and every allocation from e_main_allocator
+	extern floral::mutex						s_init_mtx;
+
+	inline thread_slot_t* get_thread_slot(const u32 i_slotIdx)
+	{
+		if (i_slotIdx >= THREADS_CAP)
+		{
+			return nullptr;
+		}
+		thread_slot_chunk_t* chunk = s_thread_slot_chunks[i_slotIdx / THREAD_SLOTS_PER_CHUNK].load(std::memory_order_acquire);
+		return chunk ? &chunk->slots[i_slotIdx % THREAD_SLOTS_PER_CHUNK] : nullptr;
+	}
 
 	// thread local data
 	struct capture_info {
@@ -23,13 +115,150 @@ namespace detail {
 		c8										name[CAPTURE_NAME_LENGTH];
 
 		u32										current_depth;
+		u16										scope_name_ids[ALLOCATION_SCOPES_CAP];	// [depth - 1], the scopes allocations are attributed to
 		sidx									event_buffer_idx;
+		unpacked_event_buffer_t*				event_buffer;
+		scope_statistics_table_t*				statistics;								// null when not aggregating
 
 		u64										thread_frequency;
-		pool_allocator_t<event>*				event_allocator;
+		// into the thread slot, which outlives the thread: null when not capturing
+		std::atomic<u32>*						enabled_categories;
 	};
 
 	extern thread_local capture_info			s_capture_info;
 
+	// per-callsite, per-thread state of a sampled scope
+	struct scope_sampler_t {
+		u32										skipped;								// invocations since the last recorded one, reset by profile_scope
+		u64										next_time_stamp;
+	};
+
+	// records 1 in rate invocations, the recorded one weighs rate
+	struct sample_every_t {
+		u32										rate;
+
+		inline const bool should_sample(scope_sampler_t& io_sampler, u32& o_weight) const
+		{
+			if (++io_sampler.skipped < rate) {
+				return false;
+			}
+			o_weight = io_sampler.skipped;
+			return true;
+		}
+	};
+
+	// records at most one invocation per period, weighing all the invocations of the period;
+	// costs a clock read per invocation
+	struct sample_period_t {
+		u32										period_ms;
+
+		inline const bool should_sample(scope_sampler_t& io_sampler, u32& o_weight) const
+		{
+			io_sampler.skipped++;
+			const u64 now = read_clock();
+			if (now < io_sampler.next_time_stamp) {
+				return false;
+			}
+			o_weight = io_sampler.skipped;
+			io_sampler.next_time_stamp = now + s_capture_info.thread_frequency * period_ms / 1000;
+			return true;
+		}
+	};
+
+	// profile_scope::scope_event.widx of a scope that was filtered out at runtime
+	static constexpr s64 k_scope_disabled = -2;
+
+	inline const bool is_category_enabled(const u32 i_category)
+	{
+		const std::atomic<u32>* enabledCategories = s_capture_info.enabled_categories;
+		return enabledCategories != nullptr && (enabledCategories->load(std::memory_order_relaxed) & i_category) != 0;
+	}
+
+	inline void unpack_event(const event_record_t& i_record, unpacked_event& o_event)
+	{
+		o_event.time_stamp = i_record.time_stamp;
+		o_event.duration_ticks = i_record.duration_ticks;
+		o_event.duration_ms = ticks_to_ms(i_record.duration_ticks);
+		o_event.depth = i_record.depth & k_depth_mask;
+		o_event.name_id = i_record.name_id;
+		o_event.weight = i_record.weight;
+		o_event.name = get_name(i_record.name_id);
+		apply_event_kind((event_kind_e)((i_record.depth >> k_kind_depth_shift) & k_event_kind_mask), o_event);
+		o_event.cpu_counter_mask = 0;
+		memset(o_event.cpu_counters, 0, sizeof(o_event.cpu_counters));
+	}
+
+	// instantaneous records reuse duration_ticks for their payload
+	inline const u64 get_record_end_time_stamp(const event_record_t& i_record)
+	{
+		const event_kind_e kind = (event_kind_e)((i_record.depth >> k_kind_depth_shift) & k_event_kind_mask);
+		const bool timed = kind == event_kind_e::scope || kind == event_kind_e::lock_wait || kind == event_kind_e::lock_hold;
+		return timed ? i_record.time_stamp + i_record.duration_ticks : i_record.time_stamp;
+	}
+
+	// seqlock style read: the sequence is checked again after the copy, so a slot that an
+	// overwriting producer started to reuse in the meantime is reported as not published
+	inline const bool read_event_slot(const event_slot_t& i_slot, const u64 i_pos, event_record_t& o_record)
+	{
+		if (i_slot.sequence.load(std::memory_order_acquire) != i_pos + 1) {
+			return false;
+		}
+		o_record = i_slot.data;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return i_slot.sequence.load(std::memory_order_relaxed) == i_pos + 1;
+	}
+
+	// read_event_slot + the side record of a counted event, validated by the same sequence
+	inline const bool read_event(const unpacked_event_buffer_t& i_buffer, const u64 i_pos, unpacked_event& o_event)
+	{
+		const event_slot_t& slot = i_buffer.data[i_pos & (EVENTS_CAP - 1)];
+		event_record_t record;
+		if (!read_event_slot(slot, i_pos, record)) {
+			return false;
+		}
+		unpack_event(record, o_event);
+		if (record.depth & k_counted_depth_bit) {
+			const cpu_counters_record_t counters = i_buffer.counters[i_pos & (EVENTS_CAP - 1)];
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.sequence.load(std::memory_order_relaxed) != i_pos + 1) {
+				return false;
+			}
+			unpack_cpu_counters(counters.mask, counters.values, o_event);
+		}
+		return true;
+	}
+
+	inline void add_to_counter(std::atomic<u64>& io_counter)
+	{
+		// single writer, no need for a read-modify-write
+		io_counter.store(io_counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	// a retired slot goes back to the free list once the consumer has read everything its thread
+	// published: every event of a stopped thread was published before it retired the slot
+	inline void recycle_thread_slot(thread_slot_t& io_threadSlot)
+	{
+		io_threadSlot.state.store((u32)thread_slot_state_e::free, std::memory_order_release);
+	}
+
+	// consumer side of a compact thread slot
+	template <typename t_visitor>
+	const u32 visit_compact_thread_slot(const u32 i_slotIdx, t_visitor& i_visitor, const u32 i_maxEvents)
+	{
+		thread_slot_t* threadSlot = get_thread_slot(i_slotIdx);
+		if (threadSlot == nullptr) {
+			return 0;
+		}
+		const thread_slot_state_e state = (thread_slot_state_e)threadSlot->state.load(std::memory_order_acquire);
+		if (state == thread_slot_state_e::free || threadSlot->buffer.storage_mode != storage_mode_e::compact) {
+			return 0;
+		}
+		const u32 count = visit_compact_events(threadSlot->buffer.compact, i_visitor, i_maxEvents);
+		if (state == thread_slot_state_e::retired && count < i_maxEvents) {
+			recycle_thread_slot(*threadSlot);
+		}
+		return count;
+	}
+
 }
 }
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <floral.h>
+
+#include <atomic>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "lotus/configs.h"
+
+namespace lotus {
+namespace detail {
+
+	// log-linear (HDR-style) buckets: values below 2^sub_bits map to themselves, above that every
+	// power of two is split into 2^sub_bits linear sub-buckets
+	static constexpr u32 k_histogram_sub_buckets = 1u << HISTOGRAM_SUB_BUCKET_BITS;
+	static constexpr u32 k_histogram_buckets_count = (64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * k_histogram_sub_buckets;
+
+	inline const u32 find_highest_bit(const u64 i_value)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanReverse64(&index, i_value);
+		return (u32)index;
+#else
+		return 63 - (u32)__builtin_clzll(i_value);
+#endif
+	}
+
+	inline const u32 get_histogram_bucket(const u64 i_value)
+	{
+		if (i_value < k_histogram_sub_buckets)
+		{
+			return (u32)i_value;
+		}
+		const u32 exponent = find_highest_bit(i_value);
+		const u32 mantissa = (u32)(i_value >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) & (k_histogram_sub_buckets - 1);
+		return (exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * k_histogram_sub_buckets + mantissa;
+	}
+
+	// middle of the value range covered by a bucket
+	inline const f64 get_histogram_bucket_value(const u32 i_bucket)
+	{
+		if (i_bucket < k_histogram_sub_buckets)
+		{
+			return (f64)i_bucket;
+		}
+		const u32 exponent = i_bucket / k_histogram_sub_buckets + HISTOGRAM_SUB_BUCKET_BITS - 1;
+		const u32 mantissa = i_bucket % k_histogram_sub_buckets;
+		const u64 width = 1ull << (exponent - HISTOGRAM_SUB_BUCKET_BITS);
+		return (f64)((k_histogram_sub_buckets + mantissa) * width) + (f64)width * 0.5;
+	}
+
+	// single writer (the owning thread, relaxed load + store), any number of relaxed readers
+	struct scope_statistics_entry_t {
+		std::atomic<u64>						count;
+		std::atomic<u64>						total_ticks;
+		std::atomic<u64>						min_ticks;
+		std::atomic<u64>						max_ticks;
+		std::atomic<u64>						buckets[k_histogram_buckets_count];
+
+		// allocations made while the scope was the innermost one
+		std::atomic<u64>						allocations_count;
+		std::atomic<u64>						allocated_bytes;
+		std::atomic<u64>						frees_count;
+		std::atomic<u64>						freed_bytes;
+	};
+
+	struct scope_statistics_table_t {
+		std::atomic<scope_statistics_entry_t*>	entries[NAMES_CAP];						// indexed by name id
+		scope_statistics_entry_t*				pool;
+		u32										pool_used;
+	};
+
+	scope_statistics_table_t*					create_scope_statistics_table();
+	// zeroes the entries in place, they keep their name ids
+	void										reset_scope_statistics_table(scope_statistics_table_t* i_table);
+	void										record_scope_statistics(scope_statistics_table_t* i_table, const u32 i_nameId, const u64 i_durationTicks,
+													const u32 i_weight);
+	void										record_allocation_statistics(scope_statistics_table_t* i_table, const u32 i_nameId, const u64 i_size,
+													const bool i_free);
+
+}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <floral.h>
+
+#include <atomic>
+
+#include "lotus/configs.h"
+
+namespace lotus {
+namespace detail {
+
+	enum class trigger_state_e : u32 {
+		disarmed = 0,
+		armed,
+		firing,																			// the firing thread is pinning the window
+		fired,																			// waiting for process_trigger
+		dumped																			// the dump is held by the user
+	};
+
+	// hot path view of the trigger, checked at every end_event
+	extern std::atomic<u32>						s_trigger_name_id;
+	extern std::atomic<u64>						s_trigger_threshold_ticks;
+
+	// window of a fired trigger that process_trigger has not copied yet, s_trigger_pin_end is 0
+	// otherwise. The producers do not reuse a slot that holds an event overlapping it.
+	extern std::atomic<u64>						s_trigger_pin_begin;
+	extern std::atomic<u64>						s_trigger_pin_end;
+
+	// i_endTimeStamp is i_beginTimeStamp for instantaneous records
+	inline const bool is_pinned_by_trigger(const u64 i_beginTimeStamp, const u64 i_endTimeStamp)
+	{
+		const u64 pinEnd = s_trigger_pin_end.load(std::memory_order_acquire);
+		return pinEnd != 0 && i_beginTimeStamp <= pinEnd
+			&& i_endTimeStamp >= s_trigger_pin_begin.load(std::memory_order_relaxed);
+	}
+
+	// called by the thread that saw the slow scope: only pins the window (a few stores, no
+	// locking), process_trigger copies it
+	void										fire_trigger(const u32 i_nameId, const u64 i_timeStamp, const u64 i_durationTicks);
+
+}
+}
@@ -40,16 +40,128 @@ struct hardware_counters_buffer_t
 	f32*										external_memory_write_bytes;
 };
 
+// same order as hwcpipe::gpu_counter_e, counter sets are masks of 1 << counter
+enum class hardware_counter_e : u32
+{
+	gpu_cycles = 0,
+	fragment_cycles,
+	tiler_cycles,
+	frag_elim,
+	tiles,
+
+	shader_cycles,
+	shader_arithmetic_cycles,
+	shader_texture_cycles,
+	varying_16_bits,
+	varying_32_bits,
+
+	external_memory_read_bytes,
+	external_memory_write_bytes,
+
+	count
+};
+
+// the counters of hardware_counters_t
+static constexpr u32							k_default_hardware_counters = ((1u << (u32)hardware_counter_e::count) - 1)
+	& ~(1u << (u32)hardware_counter_e::shader_cycles) & ~(1u << (u32)hardware_counter_e::shader_arithmetic_cycles);
+
+// this struct is copyable
+struct gpu_counters_sample_t
+{
+	u64											time_stamp;								// lotus clock, when the dump was read
+	u64											gpu_time_stamp;							// hwcnt dump time stamp, nanoseconds
+	u64											values[(u32)hardware_counter_e::count];	// 0 for counters that are not enabled
+};
+
+// columnar storage of counter samples, grows by chunks of COUNTERS_CHUNK_SAMPLES samples.
+// A chunk holds the time stamps column then one column per counter of the set, in
+// hardware_counter_e order, see get_counters_column.
+struct hardware_counters_store_t
+{
+	u32											counter_mask;
+	u32											columns_count;
+	u32											samples_count;
+	u32											chunks_count;
+	u64*										chunks[COUNTERS_CHUNKS_CAP];
+};
+
+// perf_event hardware then software events, counter sets are masks of 1 << counter
+enum class cpu_counter_e : u32
+{
+	cycles = 0,
+	instructions,
+	cache_references,
+	cache_misses,
+	branch_instructions,
+	branch_misses,
+
+	// what the OS did to the thread, the hardware counters do not need the PMU for these
+	context_switches,
+	cpu_migrations,
+	minor_faults,
+	major_faults,
+	task_clock,																	// nanoseconds on CPU, compare with the wall time duration
+
+	count
+};
+static constexpr u32							k_first_software_cpu_counter = (u32)cpu_counter_e::context_switches;
+
+// enough for IPC and cache miss rate
+static constexpr u32							k_default_cpu_counters = (1u << (u32)cpu_counter_e::cycles)
+	| (1u << (u32)cpu_counter_e::instructions) | (1u << (u32)cpu_counter_e::cache_references)
+	| (1u << (u32)cpu_counter_e::cache_misses);
+
+// tells a scope that was descheduled or faulting from one that was busy
+static constexpr u32							k_scheduling_cpu_counters = (1u << (u32)cpu_counter_e::context_switches)
+	| (1u << (u32)cpu_counter_e::minor_faults) | (1u << (u32)cpu_counter_e::major_faults)
+	| (1u << (u32)cpu_counter_e::task_clock);
+
+enum class storage_mode_e : u32 {
+	fixed = 0,																			// one fixed-size record per event, begin order
+	compact,																			// delta + varint encoded blocks, completion order
+	none																				// no raw events, e.g. when only aggregating statistics
+};
+
+// what a full event ring does with a new event
+enum class overflow_policy_e : u32 {
+	drop_newest = 0,																// the new event is lost
+	overwrite_oldest																// flight recorder, the oldest unread events are lost (fixed storage only)
+};
+
+// what an event record stands for
+enum class event_kind_e : u32 {
+	scope = 0,
+	allocation,																			// name is the innermost open scope, k_invalid_name_id outside of any
+	free,
+	plot,																				// name is the plot track
+	// async and flow events carry a 64-bit id, see flows.h
+	async_begin,																		// name is the async operation
+	async_end,
+	flow_start,																			// name is the innermost open scope, k_invalid_name_id outside of any
+	flow_end,
+	// contended acquisitions of an instrumented_mutex, see locks.h
+	lock_wait,																			// name is the lock
+	lock_hold
+};
+static constexpr u32 k_event_kind_mask = 15;
+
 // this struct is copyable
 struct event {
 	u64										time_stamp;
 	u64										duration_ticks;
-	f64										duration_ms;
 	u32										depth;
-	//const_cstr								name;
-	c8										name[CAPTURE_NAME_LENGTH];
+	u32										name_id;
+	u32										weight;	// number of invocations this event stands for, see sampled scopes
+
+	s64										widx;	// write position in the event ring, -1 if dropped
+};
 
-	sidx									widx;
+// this struct is copyable
+// an event that also records the deltas of the calling thread's CPU counters
+struct counted_event {
+	event									base;
+	u32										cpu_counter_mask;	// 0 when the thread has no counters
+	u64										cpu_counters[CPU_COUNTERS_CAP];	// ascending counter order, begin values until end_event
 };
 
 // this struct is copyable
@@ -57,12 +169,29 @@ struct event {
 struct unpacked_event {
 	u64										time_stamp;
 	u64										duration_ticks;
-	f64										duration_ms;
+	f64										duration_ms;	// filled when unpacked
 	u32										depth;
-	//const_cstr								name;
-	c8										name[CAPTURE_NAME_LENGTH];
+	u32										name_id;
+	u32										weight;	// 1 unless the scope is sampled, scale counts and totals by it
+	const_cstr								name;	// resolved from the name registry when unpacked
+	event_kind_e							kind;
+
+	// allocation and free events only, their duration is 0
+	u64										size;	// bytes
+	u32										allocator_id;
+	const_cstr								allocator_name;
+
+	// plot events only
+	f64										value;
+
+	// async and flow events only, their duration is 0
+	u64										id;
+
+	// lock_wait events only: the thread that held the lock when the wait began
+	u32										owner_thread_id;
 
-	bool									ready;
+	u32										cpu_counter_mask;	// counters recorded by a counted scope, 0 otherwise
+	u64										cpu_counters[(u32)cpu_counter_e::count];	// deltas, indexed by cpu_counter_e
 };
 
 struct unpacked_capture {
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <floral.h>
+
+#include "configs.h"
+#include "events.h"
+#include "names.h"
+
+namespace lotus {
+
+	// async events: begin and end of an operation that is not nested in one thread's scopes,
+	// e.g. a job from enqueue to completion. Flow events link the innermost open scope of a
+	// producer (record_flow_start) to the one of a consumer (record_flow_end).
+	// Both are keyed by an application chosen 64-bit id, unique among the operations in flight,
+	// and go into the calling thread's event ring like any other event.
+	void										begin_async_event(const u32 i_nameId, const u64 i_id);
+	void										end_async_event(const u32 i_nameId, const u64 i_id);
+	void										record_flow_start(const u64 i_id);
+	void										record_flow_end(const u64 i_id);
+
+	// -----------------------------------------
+	// this struct is copyable
+	struct flow_t {
+		event_kind_e							kind;									// async_begin for an async span, flow_start for a flow link
+		u64										id;
+		// async spans: the name of the operation on both ends, flow links: the enclosing scopes
+		u32										begin_name_id;
+		u32										end_name_id;
+		const_cstr								begin_name;
+		const_cstr								end_name;
+		u32										begin_thread_slot;
+		u32										end_thread_slot;
+		u64										begin_time_stamp;
+		u64										end_time_stamp;
+		f64										duration_ms;							// latency of a flow link, negative if the clocks of the threads disagree
+	};
+
+	struct pending_flow_t {
+		u64										id;
+		u64										time_stamp;
+		u32										name_id;
+		u32										thread_slot;
+		event_kind_e							kind;									// the half that arrived first, scope when the entry is free
+	};
+
+	// matches the halves of async spans and flow links, whatever the order in which the thread
+	// slots are unpacked: the first half waits in an open addressing table until the other one
+	// is added.
+	struct flow_tracker_t {
+		pending_flow_t							entries[FLOWS_CAP];
+		u32										pending_count;
+		u64										dropped_count;							// halves lost because the table was full
+	};
+
+	flow_tracker_t*								create_flow_tracker();
+	void										reset_flow_tracker(flow_tracker_t& io_tracker);
+	// i_event is an unpacked event of thread slot i_threadSlot, other kinds than async and flow are
+	// skipped. Returns true and fills o_flow when it completed an async span or a flow link.
+	const bool									add_flow_event(flow_tracker_t& io_tracker, const u32 i_threadSlot,
+													const unpacked_event& i_event, flow_t& o_flow);
+
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <floral.h>
+#include <floral/thread/mutex.h>
+
+#include <atomic>
+
+#include "names.h"
+#include "lotus/detail/locks.h"
+
+namespace lotus {
+
+	// acquisitions that waited longer than this are recorded as lock_wait / lock_hold events
+	// (see unpacked_event), 0 by default: every contended acquisition is recorded.
+	// Aggregates count all of them regardless.
+	void										set_lock_contention_threshold(const f64 i_thresholdMs);
+
+	// -----------------------------------------
+	// drop-in replacement for floral::mutex. The uncontended path is a single try_lock plus a
+	// relaxed store of the owner thread id, the clock is only read once try_lock failed.
+	// The statistics are only written by the holder of the lock and may be read from anywhere.
+	struct instrumented_mutex {
+		instrumented_mutex(const_cstr i_name);
+		~instrumented_mutex();
+
+		void lock()
+		{
+			if (mtx.try_lock()) {
+				owner_thread_id.store(detail::get_capture_thread_id(), std::memory_order_relaxed);
+				acquisitions_count.store(acquisitions_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				return;
+			}
+			lock_contended();
+		}
+
+		const bool try_lock()
+		{
+			if (mtx.try_lock()) {
+				owner_thread_id.store(detail::get_capture_thread_id(), std::memory_order_relaxed);
+				acquisitions_count.store(acquisitions_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				return true;
+			}
+			return false;
+		}
+
+		void unlock()
+		{
+			if (contended_time_stamp != 0) {
+				unlock_contended();
+			}
+			mtx.unlock();
+		}
+
+		void									lock_contended();
+		void									unlock_contended();
+
+		floral::mutex							mtx;
+		u32										lock_id;
+		std::atomic<u32>						owner_thread_id;
+		u64										contended_time_stamp;					// when a contended acquisition got the lock, 0 otherwise
+		u64										contended_wait_ticks;
+
+		std::atomic<u64>						acquisitions_count;
+		std::atomic<u64>						contentions_count;
+		std::atomic<u64>						total_wait_ticks;
+		std::atomic<u64>						max_wait_ticks;
+		std::atomic<u64>						total_hold_ticks;						// of contended acquisitions only
+		std::atomic<u64>						max_hold_ticks;
+
+		// registry of the live mutexes, for collect_lock_statistics
+		instrumented_mutex*						prev;
+		instrumented_mutex*						next;
+	};
+
+	struct instrumented_lock_guard {
+		instrumented_lock_guard(instrumented_mutex& i_mutex)
+			: mutex(i_mutex)
+		{
+			mutex.lock();
+		}
+
+		~instrumented_lock_guard()
+		{
+			mutex.unlock();
+		}
+
+		instrumented_mutex&						mutex;
+	};
+
+	// -----------------------------------------
+	// this struct is copyable
+	struct lock_statistics_t {
+		u32										lock_id;
+		const_cstr								name;
+		u32										mutexes_count;							// live mutexes sharing the name
+
+		u64										acquisitions_count;
+		u64										contentions_count;
+		f64										contention_ratio;
+		f64										total_wait_ms;
+		f64										mean_wait_ms;
+		f64										max_wait_ms;
+		f64										total_hold_ms;							// of contended acquisitions only
+		f64										mean_hold_ms;
+		f64										max_hold_ms;
+	};
+
+	void										get_lock_statistics(const instrumented_mutex& i_mutex, lock_statistics_t& o_statistics);
+	// merges the live mutexes by name, returns the number of entries written.
+	// Statistics of destroyed mutexes are lost.
+	const u32									collect_lock_statistics(lock_statistics_t* o_statistics, const u32 i_capacity);
+	void										reset_lock_statistics(instrumented_mutex& io_mutex);
+
+}
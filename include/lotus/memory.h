@@ -10,8 +10,4 @@ typedef helich::allocator<helich::stack_scheme, helich::no_tracking_policy>	line
 typedef helich::allocator<helich::freelist_scheme, helich::no_tracking_policy>	freelist_arena_t;
 
 extern linear_allocator_t						e_main_allocator;
-
-// allocators for each threads
-template <typename t_object>
-using pool_allocator_t = helich::fixed_allocator<helich::pool_scheme, sizeof(t_object), helich::no_tracking_policy>;
 }
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <floral.h>
+
+namespace lotus {
+
+	// id 0 is reserved for names that could not be registered
+	static constexpr u32 k_invalid_name_id = 0;
+
+	// thread-safe and idempotent: registering the same string twice returns the same id
+	const u32									register_name(const_cstr i_name);
+	// lock-free, valid for any id returned by register_name
+	const_cstr									get_name(const u32 i_nameId);
+	const u32									get_names_count();
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <floral.h>
+
+#include "events.h"
+#include "names.h"
+
+namespace lotus {
+
+	// plot values go into the calling thread's event ring next to its scopes (kind plot, see
+	// unpacked_event), one counter track per plot id. Threads that do not capture ignore them.
+	// Plot ids share the name registry.
+	inline const u32							register_plot(const_cstr i_name) { return register_name(i_name); }
+	void										plot(const u32 i_plotId, const f64 i_value);
+
+	// -----------------------------------------
+	// this struct is copyable
+	struct plot_bucket_t {
+		u64										time_stamp;	// start of the bucket, a multiple of the bucket duration
+		u32										samples_count;
+		f64										min;
+		f64										max;
+		f64										avg;
+	};
+
+	// min / max / avg decimation of one track of a long capture: feed it the unpacked events in
+	// time order (as unpack_capture returns them for one thread), the other events are skipped.
+	// Buckets are aligned on the clock so that tracks of different threads line up.
+	struct plot_decimator_t {
+		u32										plot_id;
+		u64										bucket_ticks;
+		plot_bucket_t							bucket;
+		f64										sum;
+	};
+
+	void										init_plot_decimator(plot_decimator_t& o_decimator, const u32 i_plotId, const f64 i_bucketMs);
+	// true when the event closed the current bucket, o_bucket is then filled
+	const bool									add_plot_event(plot_decimator_t& io_decimator, const unpacked_event& i_event, plot_bucket_t& o_bucket);
+	// closes the last bucket, false if it is empty
+	const bool									flush_plot_decimator(plot_decimator_t& io_decimator, plot_bucket_t& o_bucket);
+
+	// the above over a whole array of unpacked events, returns the number of buckets written
+	const u32									decimate_plot(const unpacked_event* i_events, const u32 i_eventsCount, const u32 i_plotId,
+													const f64 i_bucketMs, plot_bucket_t* o_buckets, const u32 i_capacity);
+
+}
+
+// the plot id is interned once per call site
+#define LOTUS_PLOT(PlotName, Value)														\
+	lotus::plot([]() -> u32 {															\
+		static const u32 lotus_plot_id_this_plot = lotus::register_plot(PlotName);		\
+		return lotus_plot_id_this_plot; }(), (f64)(Value))
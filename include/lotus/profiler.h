@@ -3,44 +3,246 @@
 #include <floral.h>
 
 #include "events.h"
+#include "clock.h"
+#include "names.h"
+#include "statistics.h"
+#include "trigger.h"
+#include "cpu_counters.h"
+#include "allocations.h"
+#include "plots.h"
+#include "flows.h"
+#include "locks.h"
+#include "timeline.h"
 #include "lotus/detail/profiler.h"
 
 namespace lotus {
 
-	void										init_capture_for_this_thread(const u32 i_threadId, const_cstr i_captureName);
+	// i_aggregateStatistics keeps per-scope statistics (see statistics.h) updated at every end_event,
+	// combine it with storage_mode_e::none to never store raw events
+	void										init_capture_for_this_thread(const u32 i_threadId, const_cstr i_captureName,
+													const storage_mode_e i_storageMode = storage_mode_e::fixed,
+													const bool i_aggregateStatistics = false);
 	void										stop_capture_for_this_thread();
-	const bool									init_hardware_counters();
+	// slot indices passed to unpack_capture are in [0, get_thread_slots_count()), slots of stopped
+	// threads are recycled after their last events have been unpacked
+	const u32									get_thread_slots_count();
+	const bool									get_thread_slot_info(const u32 i_slotIdx, u32& o_threadId, const_cstr& o_name);
+	// what the calling thread's ring does when it is full, threads start with drop_newest
+	void										set_overflow_policy_for_this_thread(const overflow_policy_e i_policy);
+	// events lost by a thread slot since its thread started capturing. The overwritten count may be
+	// a few events over when the consumer catches up with an overwriting producer (OVERWRITE_RECHECK_EVENTS)
+	const bool									get_thread_slot_overflow_stats(const u32 i_slotIdx, u64& o_droppedEvents, u64& o_overwrittenEvents);
+	// i_counterMask is a set of 1 << hardware_counter_e, counters outside of it are never read
+	const bool									init_hardware_counters(const u32 i_counterMask = k_default_hardware_counters);
 	void										stop_hardware_counters();
+
+	// capture sessions: a capture remembers the ring range written by every thread between
+	// begin_capture and end_capture, the last SAVED_CAPTURES closed captures stay retained.
+	// Sessions own the read side of the fixed-size rings (they advance the read position when a
+	// capture is evicted), do not drain the same threads with unpack_capture at the same time.
+	// begin_capture implicitly closes a capture left open.
 	void										begin_capture(const u64 i_captureIdx);
 	void										end_capture(const u64 i_captureIdx);
+	const bool									is_capture_saved(const u64 i_captureIdx);
+	// copies at most SAVED_EVENTS_COUNT events of a thread slot out of a retained capture
+	const bool									unpack_saved_capture(unpacked_capture& o_capture, const u64 i_captureIdx, const u32 i_slotIdx);
+
+	// GPU counters dumped by a dedicated thread every i_periodUs, after init_hardware_counters.
+	// While it runs capture_counters_into hands out the latest sample instead of dumping the
+	// counters on the calling thread. drain_gpu_samples consumes the samples, oldest first,
+	// and must be called from a single thread.
+	const bool									start_gpu_sampler(const u32 i_periodUs);
+	void										stop_gpu_sampler();
+	const bool									is_gpu_sampler_running();
+	const u32									drain_gpu_samples(gpu_counters_sample_t* o_samples, const u32 i_capacity);
+	// samples overwritten by the sampler before drain_gpu_samples consumed them
+	const u64									get_dropped_gpu_samples_count();
 
+	const u32									drain_gpu_samples_into(hardware_counters_store_t& io_store);
+
+	const u32									get_enabled_hardware_counters();
 	void										capture_counters_into(hardware_counters_t& o_counters);
+	// appends one sample, false when the store is full
+	const bool									capture_counters_into(hardware_counters_store_t& io_store);
 	void										capture_and_fill_counters_into(hardware_counters_buffer_t& o_buffer, const size i_offset);
 
-	template <typename t_allocator>
-	void										unpack_capture(floral::fixed_array<unpacked_event, t_allocator>& o_unpackedEvents, const sidx i_captureIdx);
-	template <typename t_allocator>
-	void										unpack_capture(floral::fast_fixed_array<unpacked_event, t_allocator>& o_unpackedEvents, const sidx i_captureIdx);
-	template <typename t_allocator, u32 t_capacity>
-	void										unpack_capture(floral::ring_buffer_st<unpacked_event, t_allocator, t_capacity>& o_unpackedEvents, const sidx i_captureIdx);
-	template <typename t_allocator, u32 t_capacity>
-	void										unpack_capture(floral::fast_ring_buffer_st<unpacked_event, t_allocator, t_capacity>& o_unpackedEvents, const sidx i_captureIdx);
+	// zero-copy consumer of a fixed-storage thread slot: the events published and not consumed
+	// yet, as at most two contiguous ranges of the ring (the second one starts at the wrap).
+	// Nothing is copied until get_span_event unpacks one event, commit_event_spans then hands
+	// the slots back to the producer. Single consumer per thread slot, no lock is taken.
+	struct event_span_t {
+		const detail::event_slot_t*				slots;
+		u64										first_pos;								// ring position of slots[0]
+		u32										count;
+	};
+
+	struct event_spans_t {
+		event_span_t							spans[2];
+		u32										spans_count;
+		u32										slot_idx;
+		const detail::unpacked_event_buffer_t*	buffer;
+		u64										begin_pos;
+		u64										end_pos;
+		bool									retired;								// the slot is recycled on commit
+	};
+
+	// false when there is nothing to read in fixed storage: free slot, compact storage (use
+	// visit_capture) or storage_mode_e::none (a retired slot is then recycled right away)
+	const bool									acquire_event_spans(const u32 i_slotIdx, event_spans_t& o_spans);
+	// false when the event was overwritten (overwrite_oldest) after acquire_event_spans
+	const bool									get_span_event(const event_spans_t& i_spans, const event_span_t& i_span, const u32 i_idx,
+													unpacked_event& o_event);
+	// releases the events of the spans, false if some of them were overwritten in the meantime
+	const bool									commit_event_spans(const event_spans_t& i_spans);
 
-	event*										allocate_event();
+	// calls i_visitor(const unpacked_event&) for every event published by a thread slot, then
+	// releases them: the events are unpacked on the stack, one at a time, whatever the storage mode.
+	// Past i_maxEvents the events are left in the slot for the next visit, returns the number visited.
+	template <typename t_visitor>
+	const u32									visit_capture(const sidx i_captureIdx, t_visitor&& i_visitor, const u32 i_maxEvents = ~0u);
+	// visit_capture into any container with push_back (floral arrays and ring buffers)
+	template <typename t_container>
+	void										unpack_capture(t_container& o_unpackedEvents, const sidx i_captureIdx);
+
+	// columnar counter stores: the set of columns is fixed at creation, usually
+	// get_enabled_hardware_counters(). A column is contiguous within a chunk, chunks are in
+	// [0, (samples_count + COUNTERS_CHUNK_SAMPLES - 1) / COUNTERS_CHUNK_SAMPLES)
+	hardware_counters_store_t*					create_hardware_counters_store(const u32 i_counterMask);
+	void										reset_hardware_counters_store(hardware_counters_store_t& io_store);
+	const bool									append_counters_sample(hardware_counters_store_t& io_store, const gpu_counters_sample_t& i_sample);
+	// nullptr if the counter is not part of the store
+	const u64*									get_counters_column(const hardware_counters_store_t& i_store, const hardware_counter_e i_counter,
+													const u32 i_chunkIdx, u32& o_samplesCount);
+	const u64*									get_counters_time_stamps(const hardware_counters_store_t& i_store, const u32 i_chunkIdx, u32& o_samplesCount);
+
+	// i_event is owned by the caller, usually on its stack, and must stay alive until end_event.
+	// i_weight is the number of invocations the event stands for when the caller samples
+	void										begin_event(event* i_event, const u32 i_nameId, const u32 i_weight = 1);
+	// slow path: interns the name on every call, prefer registering it once
 	void										begin_event(event* i_event, const_cstr i_name);
 	void										end_event(event* i_event);
+	// also records the deltas of the calling thread's CPU counters, see init_cpu_counters_for_this_thread
+	void										begin_event(counted_event* i_event, const u32 i_nameId, const u32 i_weight = 1);
+	void										end_event(counted_event* i_event);
+
+	// categories are bits of a 32-bit mask, threads start with every runtime category enabled
+	static constexpr u32						k_category_default = 1u << 0;
+	static constexpr u32						k_category_all = 0xffffffffu;
+
+	// affects the calling thread only, while it captures
+	void										set_enabled_categories(const u32 i_mask);
+	// affects every capturing thread and the threads that start capturing afterwards
+	void										set_enabled_categories_for_all_threads(const u32 i_mask);
+	const u32									get_enabled_categories();
 
 	// -----------------------------------------
+	// per-invocation state lives in the scope object itself, so recursive and concurrent
+	// invocations of the same call site never share it
 	struct profile_scope {
-		profile_scope(event* i_event, const_cstr i_name);
+		profile_scope(const u32 i_nameId);
+
+		// runtime filtered: a disabled category costs a single branch, the name is only
+		// resolved once the scope is actually recorded
+		template <typename t_name_resolver>
+		profile_scope(const u32 i_category, t_name_resolver i_resolveName)
+		{
+			if (detail::is_category_enabled(i_category)) {
+				begin_event(&scope_event, i_resolveName());
+			} else {
+				scope_event.widx = detail::k_scope_disabled;
+			}
+		}
+
+		// sampled: the thread-local sampler of the call site decides, before anything else is
+		// touched, whether this invocation is recorded and how much it weighs
+		template <typename t_sampling, typename t_name_resolver>
+		profile_scope(const u32 i_category, const t_sampling i_sampling, detail::scope_sampler_t& io_sampler,
+				t_name_resolver i_resolveName)
+		{
+			u32 weight;
+			if (detail::is_category_enabled(i_category) && i_sampling.should_sample(io_sampler, weight)) {
+				begin_event(&scope_event, i_resolveName(), weight);
+				// the weight of a dropped event goes to the next recorded one
+				if (scope_event.widx >= 0) {
+					io_sampler.skipped = 0;
+				}
+			} else {
+				scope_event.widx = detail::k_scope_disabled;
+			}
+		}
+
 		~profile_scope();
 
-		event*									pevent;
+		event									scope_event;
 	};
-	
+
+	struct counted_profile_scope {
+		template <typename t_name_resolver>
+		counted_profile_scope(const u32 i_category, t_name_resolver i_resolveName)
+		{
+			if (detail::is_category_enabled(i_category)) {
+				begin_event(&scope_event, i_resolveName());
+			} else {
+				scope_event.base.widx = detail::k_scope_disabled;
+			}
+		}
+
+		~counted_profile_scope();
+
+		counted_event							scope_event;
+	};
+
+	// stands in for scopes whose category is not in COMPILED_CATEGORIES
+	struct disabled_profile_scope {
+		template <typename... t_args>
+		disabled_profile_scope(const u32 i_category, t_args&&... i_args) { }
+	};
+
+	template <bool t_compiled, typename t_scope = profile_scope>
+	struct select_profile_scope { typedef t_scope type; };
+	template <typename t_scope>
+	struct select_profile_scope<false, t_scope> { typedef disabled_profile_scope type; };
+
+	// the only per-callsite data is the interned name, resolved on the first recorded pass
+#define PROFILE_SCOPE_CATEGORY(Category, ScopeName)									\
+	lotus::select_profile_scope<((COMPILED_CATEGORIES & (Category)) != 0)>::type	\
+		lotus_scope_this_scope(Category, []() -> u32 {									\
+			static const u32 lotus_name_id_this_scope = lotus::register_name(ScopeName);	\
+			return lotus_name_id_this_scope; })
+
 #define PROFILE_SCOPE(ScopeName)														\
-	static lotus::event *lotus_pevent_this_scope = lotus::allocate_event();			\
-	lotus::profile_scope lotus_scope_this_scope(lotus_pevent_this_scope, ScopeName)
+	PROFILE_SCOPE_CATEGORY(lotus::k_category_default, ScopeName)
+
+	// Sampling is one of lotus::detail::sample_every_t { rate } or sample_period_t { period_ms },
+	// the sampler state is per call site and per thread
+#define PROFILE_SCOPE_SAMPLED_CATEGORY(Category, ScopeName, Sampling)				\
+	lotus::select_profile_scope<((COMPILED_CATEGORIES & (Category)) != 0)>::type	\
+		lotus_scope_this_scope(Category, Sampling, []() -> lotus::detail::scope_sampler_t& {	\
+			static thread_local lotus::detail::scope_sampler_t lotus_sampler_this_scope;	\
+			return lotus_sampler_this_scope; }(), []() -> u32 {						\
+			static const u32 lotus_name_id_this_scope = lotus::register_name(ScopeName);	\
+			return lotus_name_id_this_scope; })
+
+	// records 1 in Rate invocations
+#define PROFILE_SCOPE_SAMPLED(ScopeName, Rate)										\
+	PROFILE_SCOPE_SAMPLED_CATEGORY(lotus::k_category_default, ScopeName,			\
+		lotus::detail::sample_every_t { Rate })
+
+	// records at most one invocation every PeriodMs milliseconds
+#define PROFILE_SCOPE_SAMPLED_PERIOD(ScopeName, PeriodMs)							\
+	PROFILE_SCOPE_SAMPLED_CATEGORY(lotus::k_category_default, ScopeName,			\
+		lotus::detail::sample_period_t { PeriodMs })
+
+	// also records the CPU counter deltas of the scope, e.g. for IPC or cache miss rate
+#define PROFILE_SCOPE_COUNTED_CATEGORY(Category, ScopeName)							\
+	lotus::select_profile_scope<((COMPILED_CATEGORIES & (Category)) != 0),			\
+		lotus::counted_profile_scope>::type												\
+		lotus_scope_this_scope(Category, []() -> u32 {									\
+			static const u32 lotus_name_id_this_scope = lotus::register_name(ScopeName);	\
+			return lotus_name_id_this_scope; })
+
+#define PROFILE_SCOPE_COUNTED(ScopeName)												\
+	PROFILE_SCOPE_COUNTED_CATEGORY(lotus::k_category_default, ScopeName)
 }
 
 #include "profiler.hpp"
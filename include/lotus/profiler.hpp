@@ -1,75 +1,46 @@
 namespace lotus {
 
-template <typename t_allocator>
-void unpack_capture(floral::fixed_array<unpacked_event, t_allocator>& o_unpackedEvents, const sidx i_captureIdx)
+inline const bool get_span_event(const event_spans_t& i_spans, const event_span_t& i_span, const u32 i_idx, unpacked_event& o_event)
 {
-	detail::unpacked_event_buffer_t& eb = detail::s_unpacked_event_buffers[i_captureIdx];
-	floral::lock_guard captureGuard(eb.mtx);
-
-	sidx rslot = eb.ridx;
-	sidx wslot = eb.widx;
-
-	while (rslot != wslot) {
-		if (!eb.data[rslot].ready) break;
-		o_unpackedEvents.push_back(eb.data[rslot]);
-		rslot = (rslot + 1) % EVENTS_CAP;
-	}
-
-	eb.ridx = rslot;
+	return detail::read_event(*i_spans.buffer, i_span.first_pos + i_idx, o_event);
 }
 
-template <typename t_allocator>
-void unpack_capture(floral::fast_fixed_array<unpacked_event, t_allocator>& o_unpackedEvents, const sidx i_captureIdx)
+template <typename t_visitor>
+const u32 visit_capture(const sidx i_captureIdx, t_visitor&& i_visitor, const u32 i_maxEvents)
 {
-	detail::unpacked_event_buffer_t& eb = detail::s_unpacked_event_buffers[i_captureIdx];
-	floral::lock_guard captureGuard(eb.mtx);
-
-	sidx rslot = eb.ridx;
-	sidx wslot = eb.widx;
-
-	while (rslot != wslot) {
-		if (!eb.data[rslot].ready) break;
-		o_unpackedEvents.push_back(eb.data[rslot]);
-		rslot = (rslot + 1) % EVENTS_CAP;
+	event_spans_t spans;
+	if (!acquire_event_spans((u32)i_captureIdx, spans)) {
+		return detail::visit_compact_thread_slot((u32)i_captureIdx, i_visitor, i_maxEvents);
 	}
 
-	eb.ridx = rslot;
-}
-
-template <typename t_allocator, u32 t_capacity>
-void unpack_capture(floral::ring_buffer_st<unpacked_event, t_allocator, t_capacity>& o_unpackedEvents, const sidx i_captureIdx)
-{
-	detail::unpacked_event_buffer_t& eb = detail::s_unpacked_event_buffers[i_captureIdx];
-	floral::lock_guard captureGuard(eb.mtx);
-
-	sidx rslot = eb.ridx;
-	sidx wslot = eb.widx;
-
-	while (rslot != wslot) {
-		if (!eb.data[rslot].ready) break;
-		o_unpackedEvents.push_back(eb.data[rslot]);
-		rslot = (rslot + 1) % EVENTS_CAP;
+	// only the visited events are released, the others stay for the next visit
+	if (spans.end_pos - spans.begin_pos > i_maxEvents) {
+		spans.end_pos = spans.begin_pos + i_maxEvents;
+		spans.retired = false;
 	}
-
-	eb.ridx = rslot;
+	unpacked_event eve;
+	u32 count = 0;
+	for (u32 i = 0; i < spans.spans_count; i++) {
+		const event_span_t& span = spans.spans[i];
+		for (u32 j = 0; j < span.count && span.first_pos + j < spans.end_pos; j++) {
+			// an overwritten event is already accounted for in overwritten_count
+			if (get_span_event(spans, span, j, eve)) {
+				i_visitor(eve);
+				count++;
+			}
+		}
+	}
+	commit_event_spans(spans);
+	return count;
 }
 
-template <typename t_allocator, u32 t_capacity>
-void unpack_capture(floral::fast_ring_buffer_st<unpacked_event, t_allocator, t_capacity>& o_unpackedEvents, const sidx i_captureIdx)
+template <typename t_container>
+void unpack_capture(t_container& o_unpackedEvents, const sidx i_captureIdx)
 {
-	detail::unpacked_event_buffer_t& eb = detail::s_unpacked_event_buffers[i_captureIdx];
-	floral::lock_guard captureGuard(eb.mtx);
-
-	sidx rslot = eb.ridx;
-	sidx wslot = eb.widx;
-
-	while (rslot != wslot) {
-		if (!eb.data[rslot].ready) break;
-		o_unpackedEvents.push_back(eb.data[rslot]);
-		rslot = (rslot + 1) % EVENTS_CAP;
-	}
-
-	eb.ridx = rslot;
+	auto pushBack = [&o_unpackedEvents](const unpacked_event& i_event) {
+		o_unpackedEvents.push_back(i_event);
+	};
+	visit_capture(i_captureIdx, pushBack);
 }
 
 }
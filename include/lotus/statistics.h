@@ -0,0 +1,38 @@
+#pragma once
+
+#include <floral.h>
+
+namespace lotus {
+
+	// this struct is copyable
+	struct scope_statistics_t {
+		u32										name_id;
+		const_cstr								name;
+
+		u64										count;
+		u64										total_ticks;
+		u64										min_ticks;
+		u64										max_ticks;
+
+		f64										total_ms;
+		f64										mean_ms;
+		f64										min_ms;
+		f64										max_ms;
+		f64										p50_ms;
+		f64										p95_ms;
+		f64										p99_ms;
+
+		// allocations made while the scope was the innermost one, see record_allocation
+		u64										allocations_count;
+		u64										allocated_bytes;
+		u64										frees_count;
+		u64										freed_bytes;
+	};
+
+	// merges the per-thread tables of every registered thread, one entry per scope name,
+	// returns the number of entries written. Allocations made outside of any scope are not included.
+	const u32									collect_scope_statistics(scope_statistics_t* o_statistics, const u32 i_capacity);
+	// must be called by the owning thread
+	void										reset_scope_statistics_for_this_thread();
+
+}
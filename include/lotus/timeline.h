@@ -0,0 +1,78 @@
+#pragma once
+
+#include <floral.h>
+
+#include <atomic>
+
+#include "configs.h"
+#include "events.h"
+
+#if defined(PLATFORM_POSIX)
+#include <pthread.h>
+#endif
+
+namespace lotus {
+
+	// this struct is copyable
+	struct merged_event_t {
+		const unpacked_event*					event;									// owned by the merger, valid until the next merge
+		u32										thread_slot;
+		s64										time_ns;								// since the creation of the merger, same clock for every thread
+	};
+
+	struct timeline_key_t {
+		u64										time_stamp;
+		u32										event_idx;
+		u32										padding;
+	};
+
+	// the events of one thread slot, sorted by time stamp
+	struct timeline_stream_t {
+		u32										thread_slot;
+		u32										begin;									// into events and keys
+		u32										end;
+	};
+
+	// [begin_time_stamp, next window's begin_time_stamp) of every stream, merged on its own
+	struct timeline_window_t {
+		u64										begin_time_stamp;
+		u32										output_offset;
+		u32										count;
+		std::atomic<u32>						done;
+	};
+
+	// merges the ready events of every thread slot into one time-ordered stream.
+	// Large merges are split in time windows, merged in parallel by worker threads while the
+	// first batches are already handed out.
+	struct timeline_merger_t {
+		unpacked_event*							events;
+		timeline_key_t*							keys;
+		merged_event_t*							output;
+		timeline_stream_t						streams[THREADS_CAP];
+		u32										streams_count;
+		u32										events_count;
+
+		timeline_window_t						windows[MERGE_WINDOWS_CAP];
+		u32										windows_count;
+		std::atomic<u32>						next_window;							// next one to merge
+		u32										emit_window;
+		u32										emit_offset;							// within emit_window
+
+		u64										epoch;
+		u32										batch_size;
+		u32										workers_count;
+		u32										running_workers_count;
+#if defined(PLATFORM_POSIX)
+		pthread_t								workers[MERGE_WORKERS_CAP];
+#endif
+	};
+
+	// i_workersCount threads at most (MERGE_WORKERS_CAP), batches of at most i_batchSize events
+	timeline_merger_t*							create_timeline_merger(const u32 i_workersCount, const u32 i_batchSize);
+	// drains every thread slot (see visit_capture) and starts merging, returns the number of events.
+	// Events still open in a fixed ring, or beyond MERGE_EVENTS_CAP, come with a later merge.
+	const u32									begin_timeline_merge(timeline_merger_t& io_merger);
+	// the next events in time order, 0 once the merge is exhausted
+	const u32									next_timeline_batch(timeline_merger_t& io_merger, const merged_event_t*& o_events);
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <floral.h>
+
+#include "configs.h"
+#include "events.h"
+
+namespace lotus {
+
+	struct trigger_dump_thread_t {
+		u32										slot_idx;
+		u32										thread_id;
+		c8										name[CAPTURE_NAME_LENGTH];
+		u32										first_event;							// index into trigger_dump_t::events
+		u32										events_count;
+	};
+
+	// snapshot of every thread ring, fixed or compact storage, and of the GPU counter samples over
+	// the trigger window, events of a thread are in begin order
+	struct trigger_dump_t {
+		u64										fire_time_stamp;
+		u32										name_id;								// k_invalid_name_id for a manual trigger
+		f64										duration_ms;							// duration of the scope that fired the trigger
+		f64										window_ms;
+
+		u32										threads_count;
+		trigger_dump_thread_t					threads[THREADS_CAP];
+
+		unpacked_event*							events;
+		u32										events_count;
+
+		// only while the GPU sampler runs
+		gpu_counters_sample_t*					gpu_samples;
+		u32										gpu_samples_count;
+	};
+
+	// fires when a scope named i_nameId lasts longer than i_thresholdMs (pass k_invalid_name_id
+	// for manual triggering only), the dump then covers the last i_windowMs before the firing.
+	// The dump region is allocated by the first call.
+	void										arm_trigger(const u32 i_nameId, const f64 i_thresholdMs, const u32 i_windowMs);
+	void										disarm_trigger();
+	// may be called from any thread, ignored when the trigger is not armed
+	void										fire_trigger();
+
+	// to be polled by a service thread: once the trigger fired it copies the window out of the rings
+	// (without consuming them) and returns the dump, nullptr otherwise. Until then the recorded
+	// threads keep the events of the window: they drop their new events rather than overwrite them.
+	// The dump can be written out at leisure, the trigger is re-armed by release_trigger_dump.
+	const trigger_dump_t*						process_trigger();
+	void										release_trigger_dump();
+	// triggers that fired while the dump was held
+	const u32									get_missed_triggers_count();
+
+}
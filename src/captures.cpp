@@ -0,0 +1,232 @@
+#include "lotus/profiler.h"
+
+#include "lotus/detail/profiler.h"
+
+#include <floral/thread/mutex.h>
+
+namespace lotus
+{
+
+enum class saved_capture_state_e : u32
+{
+	free = 0,
+	open,
+	closed
+};
+
+// a capture never owns events: it only remembers, for every thread slot, the range of ring
+// positions written between begin_capture and end_capture. The rings are kept from reclaiming
+// those ranges until the capture falls out of the retained set.
+struct saved_capture_t
+{
+	u64											capture_idx;
+	saved_capture_state_e						state;
+	u32											slots_count;
+	u64											begin_pos[THREADS_CAP];
+	u64											end_pos[THREADS_CAP];
+	u32											generation[THREADS_CAP];				// 0: slot not part of the capture
+};
+
+// SAVED_CAPTURES closed captures + the open one
+static saved_capture_t							s_saved_captures[SAVED_CAPTURES + 1];
+static u32										s_next_capture_slot = 0;
+static floral::mutex							s_captures_mtx;
+
+static saved_capture_t* _find_capture(const u64 i_captureIdx, const saved_capture_state_e i_state)
+{
+	for (u32 i = 0; i < SAVED_CAPTURES + 1; i++)
+	{
+		saved_capture_t& capture = s_saved_captures[i];
+		if (capture.state == i_state && capture.capture_idx == i_captureIdx)
+		{
+			return &capture;
+		}
+	}
+	return nullptr;
+}
+
+static const bool _is_slot_sessionable(detail::thread_slot_t* i_threadSlot)
+{
+	return i_threadSlot->state.load(std::memory_order_acquire) == (u32)detail::thread_slot_state_e::live
+		&& i_threadSlot->buffer.storage_mode == storage_mode_e::fixed;
+}
+
+static void _close_capture(saved_capture_t& io_capture)
+{
+	const u32 slotsCount = detail::s_thread_slots_count.load(std::memory_order_acquire);
+	for (u32 i = 0; i < slotsCount; i++)
+	{
+		if (i >= io_capture.slots_count)
+		{
+			// slot registered after begin_capture
+			io_capture.generation[i] = 0;
+			io_capture.begin_pos[i] = 0;
+			io_capture.end_pos[i] = 0;
+		}
+
+		detail::thread_slot_t* threadSlot = detail::get_thread_slot(i);
+		const u32 generation = threadSlot->generation.load(std::memory_order_relaxed);
+		if (!_is_slot_sessionable(threadSlot))
+		{
+			// a thread that stopped during the capture: the open capture kept its slot retired,
+			// the final write position ends the range
+			if (io_capture.generation[i] != 0 && io_capture.generation[i] == generation
+					&& threadSlot->state.load(std::memory_order_acquire) == (u32)detail::thread_slot_state_e::retired)
+			{
+				io_capture.end_pos[i] = threadSlot->buffer.widx.load(std::memory_order_acquire);
+			}
+			continue;
+		}
+
+		if (io_capture.generation[i] != generation)
+		{
+			// the thread started capturing in the middle of the capture, its ring starts at 0
+			io_capture.begin_pos[i] = 0;
+			io_capture.generation[i] = generation;
+		}
+		io_capture.end_pos[i] = threadSlot->buffer.widx.load(std::memory_order_acquire);
+	}
+	io_capture.slots_count = slotsCount;
+	io_capture.state = saved_capture_state_e::closed;
+}
+
+// the oldest retained capture decides how far every ring may be reclaimed. Under the init lock:
+// a slot cannot be claimed again for a new thread while we store its read position
+static void _publish_read_positions()
+{
+	floral::lock_guard initGuard(detail::s_init_mtx);
+	const u32 slotsCount = detail::s_thread_slots_count.load(std::memory_order_acquire);
+	for (u32 i = 0; i < slotsCount; i++)
+	{
+		detail::thread_slot_t* threadSlot = detail::get_thread_slot(i);
+		const u32 state = threadSlot->state.load(std::memory_order_acquire);
+		const u32 generation = threadSlot->generation.load(std::memory_order_relaxed);
+		if (state == (u32)detail::thread_slot_state_e::free || threadSlot->buffer.storage_mode != storage_mode_e::fixed)
+		{
+			continue;
+		}
+
+		u64 retainPos = ~0ull;
+		for (u32 c = 0; c < SAVED_CAPTURES + 1; c++)
+		{
+			const saved_capture_t& capture = s_saved_captures[c];
+			if (capture.state != saved_capture_state_e::free && i < capture.slots_count
+					&& capture.generation[i] == generation && capture.begin_pos[i] < retainPos)
+			{
+				retainPos = capture.begin_pos[i];
+			}
+		}
+
+		if (state == (u32)detail::thread_slot_state_e::retired)
+		{
+			if (retainPos == ~0ull)
+			{
+				// nothing of this stopped thread is retained anymore
+				threadSlot->state.store((u32)detail::thread_slot_state_e::free, std::memory_order_release);
+			}
+			continue;
+		}
+
+		const u64 wpos = threadSlot->buffer.widx.load(std::memory_order_acquire);
+		if (retainPos > wpos)
+		{
+			retainPos = wpos;
+		}
+		if (retainPos > threadSlot->buffer.ridx.load(std::memory_order_relaxed))
+		{
+			threadSlot->buffer.ridx.store(retainPos, std::memory_order_release);
+		}
+	}
+}
+
+void begin_capture(const u64 i_captureIdx)
+{
+	floral::lock_guard capturesGuard(s_captures_mtx);
+	for (u32 i = 0; i < SAVED_CAPTURES + 1; i++)
+	{
+		if (s_saved_captures[i].state == saved_capture_state_e::open)
+		{
+			_close_capture(s_saved_captures[i]);
+		}
+	}
+
+	// reuse the oldest slab, this evicts the oldest retained capture once SAVED_CAPTURES are closed
+	saved_capture_t& capture = s_saved_captures[s_next_capture_slot];
+	s_next_capture_slot = (s_next_capture_slot + 1) % (SAVED_CAPTURES + 1);
+
+	const u32 slotsCount = detail::s_thread_slots_count.load(std::memory_order_acquire);
+	capture.capture_idx = i_captureIdx;
+	capture.slots_count = slotsCount;
+	for (u32 i = 0; i < slotsCount; i++)
+	{
+		detail::thread_slot_t* threadSlot = detail::get_thread_slot(i);
+		if (_is_slot_sessionable(threadSlot))
+		{
+			capture.generation[i] = threadSlot->generation.load(std::memory_order_relaxed);
+			capture.begin_pos[i] = threadSlot->buffer.widx.load(std::memory_order_acquire);
+		}
+		else
+		{
+			capture.generation[i] = 0;
+			capture.begin_pos[i] = 0;
+		}
+		capture.end_pos[i] = capture.begin_pos[i];
+	}
+	capture.state = saved_capture_state_e::open;
+
+	_publish_read_positions();
+}
+
+void end_capture(const u64 i_captureIdx)
+{
+	floral::lock_guard capturesGuard(s_captures_mtx);
+	saved_capture_t* capture = _find_capture(i_captureIdx, saved_capture_state_e::open);
+	if (capture)
+	{
+		_close_capture(*capture);
+	}
+}
+
+const bool is_capture_saved(const u64 i_captureIdx)
+{
+	floral::lock_guard capturesGuard(s_captures_mtx);
+	return _find_capture(i_captureIdx, saved_capture_state_e::closed) != nullptr;
+}
+
+const bool unpack_saved_capture(unpacked_capture& o_capture, const u64 i_captureIdx, const u32 i_slotIdx)
+{
+	floral::lock_guard capturesGuard(s_captures_mtx);
+	o_capture.events.empty();
+	saved_capture_t* capture = _find_capture(i_captureIdx, saved_capture_state_e::closed);
+	detail::thread_slot_t* threadSlot = detail::get_thread_slot(i_slotIdx);
+	if (capture == nullptr || threadSlot == nullptr || i_slotIdx >= capture->slots_count
+			|| capture->generation[i_slotIdx] == 0
+			|| capture->generation[i_slotIdx] != threadSlot->generation.load(std::memory_order_relaxed))
+	{
+		return false;
+	}
+
+	o_capture.thread_id = threadSlot->thread_id;
+	strcpy(o_capture.name, threadSlot->name);
+
+	// the range is pinned, events inside it cannot be overwritten while the capture is retained,
+	// unless the thread uses overflow_policy_e::overwrite_oldest
+	const detail::unpacked_event_buffer_t& eb = threadSlot->buffer;
+	for (u64 pos = capture->begin_pos[i_slotIdx]; pos < capture->end_pos[i_slotIdx]; pos++)
+	{
+		if (o_capture.events.get_size() >= o_capture.events.get_capacity())
+		{
+			break;
+		}
+		unpacked_event eve;
+		if (!detail::read_event(eb, pos, eve))
+		{
+			// scope still open when the capture ended, or overwritten since
+			continue;
+		}
+		o_capture.events.push_back(eve);
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,191 @@
+#include "lotus/clock.h"
+
+#if defined(PLATFORM_WINDOWS)
+#include <Windows.h>
+#endif
+
+namespace lotus
+{
+
+namespace detail
+{
+#if defined(PLATFORM_WINDOWS)
+	clock_info_t								s_clock_info = { clock_source_e::performance_counter, 0, 0.0, 0.0 };
+#else
+	clock_info_t								s_clock_info = { clock_source_e::monotonic_raw, 1000000000ull, 1.0, 1.0e-6 };
+#endif
+
+const u64 read_performance_counter()
+{
+#if defined(PLATFORM_WINDOWS)
+	LARGE_INTEGER tp;
+	QueryPerformanceCounter(&tp);
+	return tp.QuadPart;
+#else
+	return read_monotonic_raw();
+#endif
+}
+}
+
+// reference clock used for calibration: CLOCK_MONOTONIC_RAW in nanoseconds or QPC
+static const u64 get_reference_frequency()
+{
+#if defined(PLATFORM_WINDOWS)
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	return freq.QuadPart;
+#else
+	return 1000000000ull;
+#endif
+}
+
+static void set_clock_frequency(const u64 i_frequency)
+{
+	detail::s_clock_info.frequency = i_frequency;
+	detail::s_clock_info.ns_per_tick = 1.0e9 / (f64)i_frequency;
+	detail::s_clock_info.ms_per_tick = 1.0e3 / (f64)i_frequency;
+}
+
+const bool is_clock_source_available(const clock_source_e i_source)
+{
+	switch (i_source)
+	{
+		case clock_source_e::monotonic_raw:
+#if defined(PLATFORM_WINDOWS)
+			return false;
+#else
+			return true;
+#endif
+		case clock_source_e::performance_counter:
+#if defined(PLATFORM_WINDOWS)
+			return true;
+#else
+			return false;
+#endif
+		case clock_source_e::cpu_counter:
+#if defined(_M_X64) || defined(__x86_64__) || defined(__aarch64__)
+			return true;
+#else
+			return false;
+#endif
+		default:
+			return false;
+	}
+}
+
+const bool set_clock_source(const clock_source_e i_source)
+{
+	if (!is_clock_source_available(i_source))
+	{
+		return false;
+	}
+
+	detail::s_clock_info.source = i_source;
+	switch (i_source)
+	{
+		case clock_source_e::cpu_counter:
+		{
+#if defined(__aarch64__)
+			// the generic timer advertises its own frequency, no need to calibrate
+			u64 freq;
+			asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+			if (freq != 0)
+			{
+				set_clock_frequency(freq);
+				break;
+			}
+#endif
+			calibrate_clock(20);
+			break;
+		}
+		default:
+			set_clock_frequency(get_reference_frequency());
+			break;
+	}
+	return true;
+}
+
+const clock_info_t& get_clock_info()
+{
+	if (detail::s_clock_info.frequency == 0)
+	{
+		set_clock_frequency(get_reference_frequency());
+	}
+	return detail::s_clock_info;
+}
+
+const u64 calibrate_clock(const u32 i_durationMs)
+{
+	const clock_source_e source = detail::s_clock_info.source;
+	const u64 refFrequency = get_reference_frequency();
+	if (source != clock_source_e::cpu_counter)
+	{
+		set_clock_frequency(refFrequency);
+		return refFrequency;
+	}
+
+	// bracket every counter read between two reference reads and keep the tightest pair,
+	// this removes most of the preemption noise from the measurement
+	const u64 waitRefTicks = refFrequency * i_durationMs / 1000;
+	u64 bestFrequency = 0;
+	u64 bestError = ~0ull;
+	for (u32 round = 0; round < 3; round++)
+	{
+		const u64 ref0Begin = detail::read_monotonic_raw();
+		const u64 tick0 = detail::read_cpu_counter();
+		const u64 ref0End = detail::read_monotonic_raw();
+
+		while (detail::read_monotonic_raw() - ref0End < waitRefTicks) { }
+
+		const u64 ref1Begin = detail::read_monotonic_raw();
+		const u64 tick1 = detail::read_cpu_counter();
+		const u64 ref1End = detail::read_monotonic_raw();
+
+		const u64 error = (ref0End - ref0Begin) + (ref1End - ref1Begin);
+		const u64 refElapsed = (ref1Begin + ref1End) / 2 - (ref0Begin + ref0End) / 2;
+		if (error < bestError && refElapsed > 0)
+		{
+			bestError = error;
+			bestFrequency = (u64)((f64)(tick1 - tick0) * (f64)refFrequency / (f64)refElapsed);
+		}
+	}
+
+	if (bestFrequency == 0)
+	{
+		bestFrequency = refFrequency;
+	}
+	set_clock_frequency(bestFrequency);
+	return bestFrequency;
+}
+
+const f64 measure_clock_cost(const clock_source_e i_source, const u32 i_iterations)
+{
+	if (!is_clock_source_available(i_source) || i_iterations == 0)
+	{
+		return 0.0;
+	}
+
+	// accumulate the reads so the compiler cannot drop them
+	volatile u64 sink = 0;
+	const u64 refBegin = detail::read_monotonic_raw();
+	for (u32 i = 0; i < i_iterations; i++)
+	{
+		sink += detail::read_clock(i_source);
+	}
+	const u64 refEnd = detail::read_monotonic_raw();
+	(void)sink;
+
+	return (f64)(refEnd - refBegin) * 1.0e9 / (f64)get_reference_frequency() / (f64)i_iterations;
+}
+
+const f64 ticks_to_ns(const u64 i_ticks)
+{
+	return (f64)i_ticks * detail::s_clock_info.ns_per_tick;
+}
+
+const f64 ticks_to_ms(const u64 i_ticks)
+{
+	return (f64)i_ticks * detail::s_clock_info.ms_per_tick;
+}
+
+}
@@ -0,0 +1,113 @@
+#include "lotus/profiler.h"
+
+#include "lotus/memory.h"
+#include "lotus/detail/profiler.h"
+
+namespace lotus
+{
+
+static const u32 _count_bits(u32 i_mask)
+{
+	u32 count = 0;
+	for (; i_mask != 0; i_mask &= i_mask - 1)
+	{
+		count++;
+	}
+	return count;
+}
+
+// column 0 holds the time stamps
+static const u32 _get_column_index(const hardware_counters_store_t& i_store, const hardware_counter_e i_counter)
+{
+	const u32 bit = 1u << (u32)i_counter;
+	if ((i_store.counter_mask & bit) == 0)
+	{
+		return 0;
+	}
+	return 1 + _count_bits(i_store.counter_mask & (bit - 1));
+}
+
+static const u64* _get_column(const hardware_counters_store_t& i_store, const u32 i_columnIdx, const u32 i_chunkIdx,
+		u32& o_samplesCount)
+{
+	const u32 usedChunks = (i_store.samples_count + COUNTERS_CHUNK_SAMPLES - 1) / COUNTERS_CHUNK_SAMPLES;
+	if (i_chunkIdx >= usedChunks)
+	{
+		o_samplesCount = 0;
+		return nullptr;
+	}
+	const u32 chunkBegin = i_chunkIdx * COUNTERS_CHUNK_SAMPLES;
+	o_samplesCount = i_store.samples_count - chunkBegin < COUNTERS_CHUNK_SAMPLES ?
+		i_store.samples_count - chunkBegin : COUNTERS_CHUNK_SAMPLES;
+	return i_store.chunks[i_chunkIdx] + (size)i_columnIdx * COUNTERS_CHUNK_SAMPLES;
+}
+
+hardware_counters_store_t* create_hardware_counters_store(const u32 i_counterMask)
+{
+	hardware_counters_store_t* store = nullptr;
+	{
+		floral::lock_guard initGuard(detail::s_init_mtx);
+		store = e_main_allocator.allocate<hardware_counters_store_t>();
+	}
+	store->counter_mask = i_counterMask & ((1u << (u32)hardware_counter_e::count) - 1);
+	store->columns_count = _count_bits(store->counter_mask);
+	store->samples_count = 0;
+	store->chunks_count = 0;
+	return store;
+}
+
+void reset_hardware_counters_store(hardware_counters_store_t& io_store)
+{
+	// chunks are kept for the next samples
+	io_store.samples_count = 0;
+}
+
+const bool append_counters_sample(hardware_counters_store_t& io_store, const gpu_counters_sample_t& i_sample)
+{
+	const u32 chunkIdx = io_store.samples_count / COUNTERS_CHUNK_SAMPLES;
+	if (chunkIdx >= COUNTERS_CHUNKS_CAP)
+	{
+		return false;
+	}
+	if (chunkIdx >= io_store.chunks_count)
+	{
+		// once per COUNTERS_CHUNK_SAMPLES samples, whatever thread appends
+		floral::lock_guard initGuard(detail::s_init_mtx);
+		io_store.chunks[chunkIdx] = e_main_allocator.allocate_array<u64>((size)(io_store.columns_count + 1) * COUNTERS_CHUNK_SAMPLES);
+		io_store.chunks_count++;
+	}
+
+	u64* chunk = io_store.chunks[chunkIdx];
+	const u32 row = io_store.samples_count % COUNTERS_CHUNK_SAMPLES;
+	chunk[row] = i_sample.time_stamp;
+	u32 columnIdx = 1;
+	for (u32 i = 0; i < (u32)hardware_counter_e::count; i++)
+	{
+		if (io_store.counter_mask & (1u << i))
+		{
+			chunk[(size)columnIdx * COUNTERS_CHUNK_SAMPLES + row] = i_sample.values[i];
+			columnIdx++;
+		}
+	}
+	io_store.samples_count++;
+	return true;
+}
+
+const u64* get_counters_column(const hardware_counters_store_t& i_store, const hardware_counter_e i_counter,
+		const u32 i_chunkIdx, u32& o_samplesCount)
+{
+	const u32 columnIdx = _get_column_index(i_store, i_counter);
+	if (columnIdx == 0)
+	{
+		o_samplesCount = 0;
+		return nullptr;
+	}
+	return _get_column(i_store, columnIdx, i_chunkIdx, o_samplesCount);
+}
+
+const u64* get_counters_time_stamps(const hardware_counters_store_t& i_store, const u32 i_chunkIdx, u32& o_samplesCount)
+{
+	return _get_column(i_store, 0, i_chunkIdx, o_samplesCount);
+}
+
+}
@@ -0,0 +1,329 @@
+#include "lotus/cpu_counters.h"
+
+#include "lotus/memory.h"
+#include "lotus/detail/profiler.h"
+#include "lotus/detail/cpu_counters.h"
+
+#if defined(PLATFORM_POSIX)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace lotus
+{
+
+namespace detail
+{
+	thread_local cpu_counters_info_t			s_cpu_counters_info;
+}
+
+#if defined(PLATFORM_POSIX)
+static const u64								k_perf_configs[] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_REFERENCES,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES,
+	PERF_COUNT_SW_CONTEXT_SWITCHES,
+	PERF_COUNT_SW_CPU_MIGRATIONS,
+	PERF_COUNT_SW_PAGE_FAULTS_MIN,
+	PERF_COUNT_SW_PAGE_FAULTS_MAJ,
+	PERF_COUNT_SW_TASK_CLOCK
+};
+static_assert(sizeof(k_perf_configs) / sizeof(k_perf_configs[0]) == (size)cpu_counter_e::count, "k_perf_configs must mirror cpu_counter_e");
+
+#if defined(__x86_64__) || defined(__aarch64__)
+// i_index is perf_event_mmap_page::index - 1
+static inline const u64 _read_pmc(const u32 i_index)
+{
+#if defined(__x86_64__)
+	u32 lo, hi;
+	asm volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(i_index));
+	return ((u64)hi << 32) | lo;
+#else
+	// same mapping as the kernel's libperf: 31 is the cycle counter
+	u64 value;
+	if (i_index == 31) {
+		asm volatile("mrs %0, pmccntr_el0" : "=r"(value));
+	} else {
+		asm volatile("msr pmselr_el0, %0" : : "r"((u64)i_index));
+		asm volatile("isb" : : : "memory");
+		asm volatile("mrs %0, pmxevcntr_el0" : "=r"(value));
+	}
+	return value;
+#endif
+}
+
+// the self-monitoring sequence documented in linux/perf_event.h, false when the counter is not
+// currently scheduled on the PMU (or user space access was revoked)
+static inline const bool _read_mmap_counter(const perf_event_mmap_page* i_page, u64& o_value)
+{
+	u32 seq;
+	u64 count;
+	do {
+		seq = i_page->lock;
+		std::atomic_signal_fence(std::memory_order_acquire);
+		const u32 index = i_page->index;
+		if (!i_page->cap_user_rdpmc || index == 0) {
+			return false;
+		}
+		const u32 width = i_page->pmc_width;
+		s64 pmc = (s64)_read_pmc(index - 1);
+		pmc <<= 64 - width;
+		pmc >>= 64 - width;
+		count = (u64)(i_page->offset + pmc);
+		std::atomic_signal_fence(std::memory_order_acquire);
+	} while (i_page->lock != seq);
+	o_value = count;
+	return true;
+}
+#endif
+
+// one syscall for the whole group, PERF_FORMAT_GROUP: { nr, values[nr] }
+static void _read_counters_group(const u32 i_first, const u32 i_count, u64* o_values)
+{
+	const detail::cpu_counters_info_t& info = detail::s_cpu_counters_info;
+	u64 data[1 + CPU_COUNTERS_CAP];
+	const ssize_t bytesRead = read(info.fds[i_first], data, sizeof(data));
+	const bool valid = bytesRead >= (ssize_t)sizeof(u64) && data[0] == i_count;
+	for (u32 i = 0; i < i_count; i++) {
+		// 0 when the group could not be scheduled
+		o_values[info.value_indices[i_first + i]] = valid ? data[1 + i] : 0;
+	}
+}
+
+// the fallback for the software counters, one syscall too
+static void _read_rusage_counters(u64* o_values)
+{
+	const detail::cpu_counters_info_t& info = detail::s_cpu_counters_info;
+	rusage usage;
+	if (getrusage(RUSAGE_THREAD, &usage) != 0) {
+		memset(&usage, 0, sizeof(usage));
+	}
+	u32 valueIdx = 0;
+	for (u32 i = 0; i < (u32)cpu_counter_e::count; i++) {
+		const u32 bit = 1u << i;
+		if ((info.mask & bit) == 0) {
+			continue;
+		}
+		if (info.rusage_mask & bit) {
+			switch ((cpu_counter_e)i) {
+				case cpu_counter_e::context_switches:
+					o_values[valueIdx] = (u64)(usage.ru_nvcsw + usage.ru_nivcsw);
+					break;
+				case cpu_counter_e::minor_faults:
+					o_values[valueIdx] = (u64)usage.ru_minflt;
+					break;
+				case cpu_counter_e::major_faults:
+					o_values[valueIdx] = (u64)usage.ru_majflt;
+					break;
+				default:
+					o_values[valueIdx] = ((u64)usage.ru_utime.tv_sec + (u64)usage.ru_stime.tv_sec) * 1000000000ull
+						+ ((u64)usage.ru_utime.tv_usec + (u64)usage.ru_stime.tv_usec) * 1000ull;
+					break;
+			}
+		}
+		valueIdx++;
+	}
+}
+
+static const bool _has_rusage_fallback(const cpu_counter_e i_counter)
+{
+	return i_counter == cpu_counter_e::context_switches || i_counter == cpu_counter_e::minor_faults
+		|| i_counter == cpu_counter_e::major_faults || i_counter == cpu_counter_e::task_clock;
+}
+#endif
+
+namespace detail
+{
+void read_cpu_counters(u64* o_values)
+{
+#if defined(PLATFORM_POSIX)
+	const cpu_counters_info_t& info = s_cpu_counters_info;
+	if (info.hardware_count > 0) {
+		bool read = false;
+#if defined(__x86_64__) || defined(__aarch64__)
+		if (info.user_space_read) {
+			u32 i = 0;
+			for (; i < info.hardware_count; i++) {
+				if (!_read_mmap_counter((const perf_event_mmap_page*)info.pages[i], o_values[info.value_indices[i]])) {
+					break;
+				}
+			}
+			read = i == info.hardware_count;
+		}
+#endif
+		if (!read) {
+			_read_counters_group(0, info.hardware_count, o_values);
+		}
+	}
+	if (info.perf_count > info.hardware_count) {
+		_read_counters_group(info.hardware_count, info.perf_count - info.hardware_count, o_values);
+	}
+	if (info.rusage_mask) {
+		_read_rusage_counters(o_values);
+	}
+#endif
+}
+
+void ensure_cpu_counters_records(unpacked_event_buffer_t& io_buffer)
+{
+	if (io_buffer.counters == nullptr) {
+		io_buffer.counters = e_main_allocator.allocate_array<cpu_counters_record_t>(EVENTS_CAP);
+	}
+}
+}
+
+const bool init_cpu_counters_for_this_thread(const u32 i_counterMask)
+{
+	stop_cpu_counters_for_this_thread();
+#if defined(PLATFORM_POSIX)
+	detail::cpu_counters_info_t& info = detail::s_cpu_counters_info;
+	const long pageSize = sysconf(_SC_PAGESIZE);
+	bool allMapped = true;
+	for (u32 i = 0; i < (u32)cpu_counter_e::count && info.count < CPU_COUNTERS_CAP; i++)
+	{
+		if ((i_counterMask & (1u << i)) == 0)
+		{
+			continue;
+		}
+
+		const bool hardware = i < k_first_software_cpu_counter;
+		// the software group starts once the hardware one is complete, counters go in ascending order
+		const bool leader = hardware ? info.perf_count == 0 : info.perf_count == info.hardware_count;
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type = hardware ? PERF_TYPE_HARDWARE : PERF_TYPE_SOFTWARE;
+		attr.size = sizeof(perf_event_attr);
+		attr.config = k_perf_configs[i];
+		attr.read_format = PERF_FORMAT_GROUP;
+		// context switches and migrations happen in the kernel, they would always count 0
+		attr.exclude_kernel = (cpu_counter_e)i == cpu_counter_e::context_switches
+			|| (cpu_counter_e)i == cpu_counter_e::cpu_migrations ? 0 : 1;
+		attr.exclude_hv = 1;
+		// the group starts disabled and is enabled as a whole once complete
+		attr.disabled = leader ? 1 : 0;
+		attr.pinned = leader ? 1 : 0;
+#if defined(__aarch64__)
+		// arm_pmuv3 "rdpmc" format bit, user space access also needs the perf_user_access sysctl
+		attr.config1 = hardware ? 0x2 : 0;
+#endif
+
+		// calling thread, any cpu
+		const s32 fd = (s32)syscall(__NR_perf_event_open, &attr, 0, -1, leader ? -1 : info.fds[hardware ? 0 : info.hardware_count], 0);
+		if (fd < 0)
+		{
+			// not supported by this PMU, or perf_event_paranoid / seccomp forbids it
+			if (!hardware && _has_rusage_fallback((cpu_counter_e)i))
+			{
+				info.rusage_mask |= 1u << i;
+				info.mask |= 1u << i;
+				info.count++;
+			}
+			continue;
+		}
+
+		// only the hardware counters can be read in user space
+		void* page = nullptr;
+		if (hardware)
+		{
+			page = mmap(nullptr, (size_t)pageSize, PROT_READ, MAP_SHARED, fd, 0);
+			if (page == MAP_FAILED)
+			{
+				page = nullptr;
+				allMapped = false;
+			}
+			info.hardware_count++;
+		}
+		info.fds[info.perf_count] = fd;
+		info.pages[info.perf_count] = page;
+		info.value_indices[info.perf_count] = (u8)info.count;
+		info.perf_count++;
+		info.mask |= 1u << i;
+		info.count++;
+	}
+
+	if (info.count == 0)
+	{
+		return false;
+	}
+
+	if (info.hardware_count > 0)
+	{
+		ioctl(info.fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(info.fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+	if (info.perf_count > info.hardware_count)
+	{
+		ioctl(info.fds[info.hardware_count], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(info.fds[info.hardware_count], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+
+	// the kernel tells through the mmap page whether we may read the counter registers
+	info.user_space_read = false;
+#if defined(__x86_64__) || defined(__aarch64__)
+	if (allMapped && info.hardware_count > 0)
+	{
+		info.user_space_read = true;
+		for (u32 i = 0; i < info.hardware_count; i++)
+		{
+			const perf_event_mmap_page* page = (const perf_event_mmap_page*)info.pages[i];
+			if (!page->cap_user_rdpmc)
+			{
+				info.user_space_read = false;
+				break;
+			}
+		}
+	}
+#endif
+
+	if (detail::s_capture_info.event_buffer && detail::s_capture_info.event_buffer->storage_mode == storage_mode_e::fixed)
+	{
+		floral::lock_guard initGuard(detail::s_init_mtx);
+		detail::ensure_cpu_counters_records(*detail::s_capture_info.event_buffer);
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+void stop_cpu_counters_for_this_thread()
+{
+#if defined(PLATFORM_POSIX)
+	detail::cpu_counters_info_t& info = detail::s_cpu_counters_info;
+	const long pageSize = sysconf(_SC_PAGESIZE);
+	// siblings first, the leaders own the groups
+	for (u32 i = info.perf_count; i > 0; i--)
+	{
+		if (info.pages[i - 1])
+		{
+			munmap(info.pages[i - 1], (size_t)pageSize);
+		}
+		close(info.fds[i - 1]);
+	}
+#endif
+	detail::s_cpu_counters_info.mask = 0;
+	detail::s_cpu_counters_info.count = 0;
+	detail::s_cpu_counters_info.rusage_mask = 0;
+	detail::s_cpu_counters_info.perf_count = 0;
+	detail::s_cpu_counters_info.hardware_count = 0;
+	detail::s_cpu_counters_info.user_space_read = false;
+}
+
+const u32 get_cpu_counters_for_this_thread()
+{
+	return detail::s_cpu_counters_info.mask;
+}
+
+const bool are_cpu_counters_read_in_user_space()
+{
+	return detail::s_cpu_counters_info.user_space_read;
+}
+
+}
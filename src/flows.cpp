@@ -0,0 +1,123 @@
+#include "lotus/flows.h"
+
+#include "lotus/memory.h"
+#include "lotus/clock.h"
+#include "lotus/detail/profiler.h"
+
+namespace lotus
+{
+
+static_assert((FLOWS_CAP & (FLOWS_CAP - 1)) == 0, "FLOWS_CAP must be a power of two");
+
+// both halves of a span (or of a link) map to the same key, spans and links never match each other
+static inline const event_kind_e _get_opening_kind(const event_kind_e i_kind)
+{
+	return (i_kind == event_kind_e::async_begin || i_kind == event_kind_e::async_end) ?
+		event_kind_e::async_begin : event_kind_e::flow_start;
+}
+
+static inline const u32 _hash_flow(const u64 i_id, const event_kind_e i_openingKind)
+{
+	u64 h = (i_id ^ (u64)i_openingKind) * 0x9e3779b97f4a7c15ull;
+	return (u32)(h >> 32) & (FLOWS_CAP - 1);
+}
+
+// linear probing, returns the entry holding the key or the free entry ending its probe sequence
+static const u32 _find_flow_entry(const flow_tracker_t& i_tracker, const u64 i_id, const event_kind_e i_openingKind)
+{
+	u32 idx = _hash_flow(i_id, i_openingKind);
+	while (true) {
+		const pending_flow_t& entry = i_tracker.entries[idx];
+		if (entry.kind == event_kind_e::scope
+				|| (entry.id == i_id && _get_opening_kind(entry.kind) == i_openingKind)) {
+			return idx;
+		}
+		idx = (idx + 1) & (FLOWS_CAP - 1);
+	}
+}
+
+// backward shift deletion, keeps the probe sequences intact without tombstones
+static void _remove_flow_entry(flow_tracker_t& io_tracker, u32 i_idx)
+{
+	u32 next = i_idx;
+	while (true) {
+		next = (next + 1) & (FLOWS_CAP - 1);
+		pending_flow_t& entry = io_tracker.entries[next];
+		if (entry.kind == event_kind_e::scope) {
+			break;
+		}
+		const u32 home = _hash_flow(entry.id, _get_opening_kind(entry.kind));
+		// the entry may move to the hole if its home is not cyclically in (i_idx, next]
+		if (((next - home) & (FLOWS_CAP - 1)) >= ((next - i_idx) & (FLOWS_CAP - 1))) {
+			io_tracker.entries[i_idx] = entry;
+			i_idx = next;
+		}
+	}
+	io_tracker.entries[i_idx].kind = event_kind_e::scope;
+	io_tracker.pending_count--;
+}
+
+flow_tracker_t* create_flow_tracker()
+{
+	flow_tracker_t* tracker = nullptr;
+	{
+		floral::lock_guard initGuard(detail::s_init_mtx);
+		tracker = e_main_allocator.allocate<flow_tracker_t>();
+	}
+	reset_flow_tracker(*tracker);
+	return tracker;
+}
+
+void reset_flow_tracker(flow_tracker_t& io_tracker)
+{
+	for (u32 i = 0; i < FLOWS_CAP; i++) {
+		io_tracker.entries[i].kind = event_kind_e::scope;
+	}
+	io_tracker.pending_count = 0;
+	io_tracker.dropped_count = 0;
+}
+
+const bool add_flow_event(flow_tracker_t& io_tracker, const u32 i_threadSlot, const unpacked_event& i_event, flow_t& o_flow)
+{
+	if (i_event.kind < event_kind_e::async_begin || i_event.kind > event_kind_e::flow_end) {
+		return false;
+	}
+
+	const event_kind_e openingKind = _get_opening_kind(i_event.kind);
+	const u32 idx = _find_flow_entry(io_tracker, i_event.id, openingKind);
+	pending_flow_t& entry = io_tracker.entries[idx];
+	if (entry.kind == event_kind_e::scope || entry.kind == i_event.kind) {
+		// first half, or the id was reused before the other half of its previous use came
+		if (entry.kind == event_kind_e::scope) {
+			// one free entry always remains so that probing terminates
+			if (io_tracker.pending_count == FLOWS_CAP - 1) {
+				io_tracker.dropped_count++;
+				return false;
+			}
+			io_tracker.pending_count++;
+		}
+		entry.id = i_event.id;
+		entry.time_stamp = i_event.time_stamp;
+		entry.name_id = i_event.name_id;
+		entry.thread_slot = i_threadSlot;
+		entry.kind = i_event.kind;
+		return false;
+	}
+
+	const bool opening = i_event.kind == openingKind;
+	o_flow.kind = openingKind;
+	o_flow.id = i_event.id;
+	o_flow.begin_name_id = opening ? i_event.name_id : entry.name_id;
+	o_flow.end_name_id = opening ? entry.name_id : i_event.name_id;
+	o_flow.begin_name = get_name(o_flow.begin_name_id);
+	o_flow.end_name = get_name(o_flow.end_name_id);
+	o_flow.begin_thread_slot = opening ? i_threadSlot : entry.thread_slot;
+	o_flow.end_thread_slot = opening ? entry.thread_slot : i_threadSlot;
+	o_flow.begin_time_stamp = opening ? i_event.time_stamp : entry.time_stamp;
+	o_flow.end_time_stamp = opening ? entry.time_stamp : i_event.time_stamp;
+	o_flow.duration_ms = (f64)(s64)(o_flow.end_time_stamp - o_flow.begin_time_stamp) * get_clock_info().ms_per_tick;
+	_remove_flow_entry(io_tracker, idx);
+	return true;
+}
+
+}
@@ -0,0 +1,255 @@
+#include "lotus/profiler.h"
+
+#include "lotus/detail/profiler.h"
+#include "lotus/detail/gpu_sampler.h"
+
+#include <floral/thread/mutex.h>
+
+#if defined(PLATFORM_POSIX)
+#include <pthread.h>
+#include <time.h>
+#endif
+
+namespace lotus
+{
+
+static detail::gpu_sample_ring_t*				s_gpu_samples = nullptr;
+static floral::mutex							s_sampler_mtx;
+static std::atomic<bool>						s_sampler_running(false);
+static std::atomic<bool>						s_sampler_stop(false);
+static u32										s_sampler_period_us = 0;
+#if defined(PLATFORM_POSIX)
+static pthread_t								s_sampler_thread;
+#endif
+
+static void _push_gpu_sample(const gpu_counters_sample_t& i_sample)
+{
+	detail::gpu_sample_ring_t& ring = *s_gpu_samples;
+	const u64 wpos = ring.widx.load(std::memory_order_relaxed);
+	if (wpos >= GPU_SAMPLES_CAP && detail::s_trigger_pin_end.load(std::memory_order_relaxed) != 0)
+	{
+		// the oldest sample may be in a fired trigger's window, keep it for process_trigger
+		const gpu_counters_sample_t& oldest = ring.slots[wpos & (GPU_SAMPLES_CAP - 1)].data;
+		if (detail::is_pinned_by_trigger(oldest.time_stamp, oldest.time_stamp))
+		{
+			detail::add_to_counter(ring.dropped_count);
+			return;
+		}
+	}
+	// the ring always holds the latest samples for the peekers: the oldest unconsumed one is lost
+	if (wpos - ring.ridx.load(std::memory_order_acquire) >= GPU_SAMPLES_CAP)
+	{
+		detail::add_to_counter(ring.dropped_count);
+	}
+
+	// the slot may be read right now: invalidate it before overwriting it
+	detail::gpu_sample_slot_t& slot = ring.slots[wpos & (GPU_SAMPLES_CAP - 1)];
+	slot.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.data = i_sample;
+	slot.sequence.store(wpos + 1, std::memory_order_release);
+	ring.widx.store(wpos + 1, std::memory_order_release);
+}
+
+static const bool _read_gpu_sample(const u64 i_pos, gpu_counters_sample_t& o_sample)
+{
+	const detail::gpu_sample_slot_t& slot = s_gpu_samples->slots[i_pos & (GPU_SAMPLES_CAP - 1)];
+	if (slot.sequence.load(std::memory_order_acquire) != i_pos + 1)
+	{
+		return false;
+	}
+	o_sample = slot.data;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slot.sequence.load(std::memory_order_relaxed) == i_pos + 1;
+}
+
+// the oldest unconsumed sample still in the ring, false when there is none
+static const bool _read_next_gpu_sample(u64& io_rpos, gpu_counters_sample_t& o_sample)
+{
+	const detail::gpu_sample_ring_t& ring = *s_gpu_samples;
+	while (true)
+	{
+		const u64 wpos = ring.widx.load(std::memory_order_acquire);
+		if (io_rpos == wpos)
+		{
+			return false;
+		}
+		if (wpos - io_rpos > GPU_SAMPLES_CAP)
+		{
+			// lapped by the sampler, the skipped samples are in dropped_count
+			io_rpos = wpos - GPU_SAMPLES_CAP;
+		}
+		// fails only while the sampler is overwriting the slot, it then publishes a newer widx
+		if (_read_gpu_sample(io_rpos, o_sample))
+		{
+			return true;
+		}
+	}
+}
+
+#if defined(PLATFORM_POSIX)
+static void* _gpu_sampler_main(void*)
+{
+	timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!s_sampler_stop.load(std::memory_order_acquire))
+	{
+		gpu_counters_sample_t sample;
+		detail::sample_hardware_counters(sample);
+		_push_gpu_sample(sample);
+
+		// fixed rate, a late sample does not shift the following ones but missed periods are skipped
+		next.tv_nsec += (long)s_sampler_period_us * 1000;
+		while (next.tv_nsec >= 1000000000)
+		{
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > next.tv_sec || (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec))
+		{
+			next = now;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+	}
+	return nullptr;
+}
+#endif
+
+namespace detail
+{
+const bool peek_latest_gpu_sample(gpu_counters_sample_t& o_sample)
+{
+	if (s_gpu_samples == nullptr)
+	{
+		return false;
+	}
+	const u64 wpos = s_gpu_samples->widx.load(std::memory_order_acquire);
+	return wpos > 0 && _read_gpu_sample(wpos - 1, o_sample);
+}
+
+const u32 peek_gpu_samples(const u64 i_beginTimeStamp, const u64 i_endTimeStamp,
+		gpu_counters_sample_t* o_samples, const u32 i_capacity)
+{
+	if (s_gpu_samples == nullptr)
+	{
+		return 0;
+	}
+	const u64 wpos = s_gpu_samples->widx.load(std::memory_order_acquire);
+	const u64 oldestPos = wpos > GPU_SAMPLES_CAP ? wpos - GPU_SAMPLES_CAP : 0;
+	u32 count = 0;
+	for (u64 pos = oldestPos; pos < wpos && count < i_capacity; pos++)
+	{
+		gpu_counters_sample_t& sample = o_samples[count];
+		if (_read_gpu_sample(pos, sample) && sample.time_stamp >= i_beginTimeStamp && sample.time_stamp <= i_endTimeStamp)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+}
+
+const bool start_gpu_sampler(const u32 i_periodUs)
+{
+#if defined(PLATFORM_POSIX)
+	floral::lock_guard samplerGuard(s_sampler_mtx);
+	if (s_sampler_running.load(std::memory_order_relaxed) || i_periodUs == 0)
+	{
+		return false;
+	}
+
+	if (s_gpu_samples == nullptr)
+	{
+		{
+			floral::lock_guard initGuard(detail::s_init_mtx);
+			s_gpu_samples = e_main_allocator.allocate<detail::gpu_sample_ring_t>();
+		}
+		for (u32 i = 0; i < GPU_SAMPLES_CAP; i++)
+		{
+			s_gpu_samples->slots[i].sequence.store(0, std::memory_order_relaxed);
+		}
+		s_gpu_samples->ridx.store(0, std::memory_order_relaxed);
+		s_gpu_samples->dropped_count.store(0, std::memory_order_relaxed);
+		s_gpu_samples->widx.store(0, std::memory_order_release);
+	}
+
+	s_sampler_period_us = i_periodUs;
+	s_sampler_stop.store(false, std::memory_order_relaxed);
+	if (pthread_create(&s_sampler_thread, nullptr, &_gpu_sampler_main, nullptr) != 0)
+	{
+		return false;
+	}
+	s_sampler_running.store(true, std::memory_order_release);
+	return true;
+#else
+	return false;
+#endif
+}
+
+void stop_gpu_sampler()
+{
+#if defined(PLATFORM_POSIX)
+	floral::lock_guard samplerGuard(s_sampler_mtx);
+	if (!s_sampler_running.load(std::memory_order_relaxed))
+	{
+		return;
+	}
+	s_sampler_stop.store(true, std::memory_order_release);
+	pthread_join(s_sampler_thread, nullptr);
+	// only once the thread is gone, so that nobody dumps the counters concurrently
+	s_sampler_running.store(false, std::memory_order_release);
+#endif
+}
+
+const bool is_gpu_sampler_running()
+{
+	return s_sampler_running.load(std::memory_order_acquire);
+}
+
+const u32 drain_gpu_samples(gpu_counters_sample_t* o_samples, const u32 i_capacity)
+{
+	if (s_gpu_samples == nullptr)
+	{
+		return 0;
+	}
+
+	detail::gpu_sample_ring_t& ring = *s_gpu_samples;
+	u64 rpos = ring.ridx.load(std::memory_order_relaxed);
+	u32 count = 0;
+	while (count < i_capacity && _read_next_gpu_sample(rpos, o_samples[count]))
+	{
+		count++;
+		rpos++;
+	}
+	ring.ridx.store(rpos, std::memory_order_release);
+	return count;
+}
+
+const u32 drain_gpu_samples_into(hardware_counters_store_t& io_store)
+{
+	if (s_gpu_samples == nullptr)
+	{
+		return 0;
+	}
+
+	detail::gpu_sample_ring_t& ring = *s_gpu_samples;
+	u64 rpos = ring.ridx.load(std::memory_order_relaxed);
+	u32 count = 0;
+	gpu_counters_sample_t sample;
+	while (_read_next_gpu_sample(rpos, sample) && append_counters_sample(io_store, sample))
+	{
+		count++;
+		rpos++;
+	}
+	ring.ridx.store(rpos, std::memory_order_release);
+	return count;
+}
+
+const u64 get_dropped_gpu_samples_count()
+{
+	return s_gpu_samples ? s_gpu_samples->dropped_count.load(std::memory_order_relaxed) : 0;
+}
+
+}
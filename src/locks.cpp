@@ -0,0 +1,167 @@
+#include "lotus/locks.h"
+
+#include "lotus/clock.h"
+
+namespace lotus
+{
+
+static floral::mutex							s_registry_mtx;
+static instrumented_mutex*						s_registry_head = nullptr;
+static std::atomic<u64>							s_contention_threshold_ticks(0);
+
+// only called by the holder of the lock, no read-modify-write needed
+static inline void _add(std::atomic<u64>& io_value, const u64 i_delta)
+{
+	io_value.store(io_value.load(std::memory_order_relaxed) + i_delta, std::memory_order_relaxed);
+}
+
+static inline void _max(std::atomic<u64>& io_value, const u64 i_value)
+{
+	if (i_value > io_value.load(std::memory_order_relaxed)) {
+		io_value.store(i_value, std::memory_order_relaxed);
+	}
+}
+
+void set_lock_contention_threshold(const f64 i_thresholdMs)
+{
+	s_contention_threshold_ticks.store((u64)(i_thresholdMs / get_clock_info().ms_per_tick), std::memory_order_relaxed);
+}
+
+instrumented_mutex::instrumented_mutex(const_cstr i_name)
+	: lock_id(register_name(i_name))
+	, owner_thread_id(0)
+	, contended_time_stamp(0)
+	, contended_wait_ticks(0)
+	, prev(nullptr)
+{
+	reset_lock_statistics(*this);
+	floral::lock_guard registryGuard(s_registry_mtx);
+	next = s_registry_head;
+	if (next) {
+		next->prev = this;
+	}
+	s_registry_head = this;
+}
+
+instrumented_mutex::~instrumented_mutex()
+{
+	floral::lock_guard registryGuard(s_registry_mtx);
+	if (prev) {
+		prev->next = next;
+	} else {
+		s_registry_head = next;
+	}
+	if (next) {
+		next->prev = prev;
+	}
+}
+
+void instrumented_mutex::lock_contended()
+{
+	// whoever holds the lock right now, it may have changed hands by the time we get it
+	const u32 ownerThreadId = owner_thread_id.load(std::memory_order_relaxed);
+	const u64 waitBegin = detail::read_clock();
+	mtx.lock();
+	const u64 acquired = detail::read_clock();
+	owner_thread_id.store(detail::get_capture_thread_id(), std::memory_order_relaxed);
+
+	const u64 waitTicks = acquired - waitBegin;
+	_add(acquisitions_count, 1);
+	_add(contentions_count, 1);
+	_add(total_wait_ticks, waitTicks);
+	_max(max_wait_ticks, waitTicks);
+	// 0 is the uncontended marker
+	contended_time_stamp = acquired != 0 ? acquired : 1;
+	contended_wait_ticks = waitTicks;
+
+	if (waitTicks >= s_contention_threshold_ticks.load(std::memory_order_relaxed)) {
+		detail::record_lock_event(event_kind_e::lock_wait, lock_id, waitBegin, waitTicks, ownerThreadId);
+	}
+}
+
+void instrumented_mutex::unlock_contended()
+{
+	const u64 holdTicks = detail::read_clock() - contended_time_stamp;
+	_add(total_hold_ticks, holdTicks);
+	_max(max_hold_ticks, holdTicks);
+	if (contended_wait_ticks >= s_contention_threshold_ticks.load(std::memory_order_relaxed)) {
+		detail::record_lock_event(event_kind_e::lock_hold, lock_id, contended_time_stamp, holdTicks,
+				detail::get_capture_thread_id());
+	}
+	contended_time_stamp = 0;
+}
+
+// -----------------------------------------
+static void _accumulate_lock_statistics(const instrumented_mutex& i_mutex, lock_statistics_t& io_statistics)
+{
+	const f64 msPerTick = get_clock_info().ms_per_tick;
+	const f64 maxWaitMs = (f64)i_mutex.max_wait_ticks.load(std::memory_order_relaxed) * msPerTick;
+	const f64 maxHoldMs = (f64)i_mutex.max_hold_ticks.load(std::memory_order_relaxed) * msPerTick;
+	io_statistics.mutexes_count++;
+	io_statistics.acquisitions_count += i_mutex.acquisitions_count.load(std::memory_order_relaxed);
+	io_statistics.contentions_count += i_mutex.contentions_count.load(std::memory_order_relaxed);
+	io_statistics.total_wait_ms += (f64)i_mutex.total_wait_ticks.load(std::memory_order_relaxed) * msPerTick;
+	io_statistics.total_hold_ms += (f64)i_mutex.total_hold_ticks.load(std::memory_order_relaxed) * msPerTick;
+	io_statistics.max_wait_ms = maxWaitMs > io_statistics.max_wait_ms ? maxWaitMs : io_statistics.max_wait_ms;
+	io_statistics.max_hold_ms = maxHoldMs > io_statistics.max_hold_ms ? maxHoldMs : io_statistics.max_hold_ms;
+}
+
+static void _init_lock_statistics(const u32 i_lockId, lock_statistics_t& o_statistics)
+{
+	memset(&o_statistics, 0, sizeof(lock_statistics_t));
+	o_statistics.lock_id = i_lockId;
+	o_statistics.name = get_name(i_lockId);
+}
+
+static void _finalize_lock_statistics(lock_statistics_t& io_statistics)
+{
+	if (io_statistics.acquisitions_count > 0) {
+		io_statistics.contention_ratio = (f64)io_statistics.contentions_count / (f64)io_statistics.acquisitions_count;
+	}
+	if (io_statistics.contentions_count > 0) {
+		io_statistics.mean_wait_ms = io_statistics.total_wait_ms / (f64)io_statistics.contentions_count;
+		io_statistics.mean_hold_ms = io_statistics.total_hold_ms / (f64)io_statistics.contentions_count;
+	}
+}
+
+void get_lock_statistics(const instrumented_mutex& i_mutex, lock_statistics_t& o_statistics)
+{
+	_init_lock_statistics(i_mutex.lock_id, o_statistics);
+	_accumulate_lock_statistics(i_mutex, o_statistics);
+	_finalize_lock_statistics(o_statistics);
+}
+
+const u32 collect_lock_statistics(lock_statistics_t* o_statistics, const u32 i_capacity)
+{
+	u32 entriesCount = 0;
+	floral::lock_guard registryGuard(s_registry_mtx);
+	for (const instrumented_mutex* it = s_registry_head; it != nullptr; it = it->next) {
+		u32 entryIdx = 0;
+		while (entryIdx < entriesCount && o_statistics[entryIdx].lock_id != it->lock_id) {
+			entryIdx++;
+		}
+		if (entryIdx == entriesCount) {
+			if (entriesCount == i_capacity) {
+				continue;
+			}
+			_init_lock_statistics(it->lock_id, o_statistics[entriesCount++]);
+		}
+		_accumulate_lock_statistics(*it, o_statistics[entryIdx]);
+	}
+	for (u32 i = 0; i < entriesCount; i++) {
+		_finalize_lock_statistics(o_statistics[i]);
+	}
+	return entriesCount;
+}
+
+void reset_lock_statistics(instrumented_mutex& io_mutex)
+{
+	io_mutex.acquisitions_count.store(0, std::memory_order_relaxed);
+	io_mutex.contentions_count.store(0, std::memory_order_relaxed);
+	io_mutex.total_wait_ticks.store(0, std::memory_order_relaxed);
+	io_mutex.max_wait_ticks.store(0, std::memory_order_relaxed);
+	io_mutex.total_hold_ticks.store(0, std::memory_order_relaxed);
+	io_mutex.max_hold_ticks.store(0, std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,90 @@
+#include "lotus/names.h"
+
+#include "lotus/configs.h"
+
+#include <floral/thread/mutex.h>
+
+#include <atomic>
+
+namespace lotus
+{
+
+static_assert((NAMES_CAP & (NAMES_CAP - 1)) == 0, "NAMES_CAP must be a power of two");
+
+struct name_registry_t {
+	floral::mutex								mtx;
+	std::atomic<u32>							count;
+	u32											hashes[NAMES_CAP];
+	u32											buckets[NAMES_CAP * 2];							// open addressing, 0 means empty
+	c8											names[NAMES_CAP][EVENT_NAME_LENGTH];
+};
+
+static name_registry_t							s_name_registry;
+
+static const u32 hash_name(const_cstr i_name)
+{
+	// FNV-1a over the part that fits into the registry
+	u32 hash = 2166136261u;
+	for (u32 i = 0; i < EVENT_NAME_LENGTH - 1 && i_name[i] != 0; i++)
+	{
+		hash ^= (u8)i_name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+const u32 register_name(const_cstr i_name)
+{
+	floral::lock_guard registryGuard(s_name_registry.mtx);
+	u32 count = s_name_registry.count.load(std::memory_order_relaxed);
+	if (count == 0)
+	{
+		strcpy(s_name_registry.names[k_invalid_name_id], "<invalid>");
+		count = 1;
+		s_name_registry.count.store(count, std::memory_order_release);
+	}
+
+	const u32 hash = hash_name(i_name);
+	const u32 mask = NAMES_CAP * 2 - 1;
+	u32 bucket = hash & mask;
+	while (s_name_registry.buckets[bucket] != 0)
+	{
+		const u32 id = s_name_registry.buckets[bucket];
+		if (s_name_registry.hashes[id] == hash
+				&& strncmp(s_name_registry.names[id], i_name, EVENT_NAME_LENGTH - 1) == 0)
+		{
+			return id;
+		}
+		bucket = (bucket + 1) & mask;
+	}
+
+	if (count >= NAMES_CAP)
+	{
+		return k_invalid_name_id;
+	}
+
+	const u32 newId = count;
+	strncpy(s_name_registry.names[newId], i_name, EVENT_NAME_LENGTH - 1);
+	s_name_registry.names[newId][EVENT_NAME_LENGTH - 1] = 0;
+	s_name_registry.hashes[newId] = hash;
+	s_name_registry.buckets[bucket] = newId;
+	// publish the string before the id becomes visible to lock-free readers
+	s_name_registry.count.store(newId + 1, std::memory_order_release);
+	return newId;
+}
+
+const_cstr get_name(const u32 i_nameId)
+{
+	if (i_nameId >= s_name_registry.count.load(std::memory_order_acquire))
+	{
+		return "<invalid>";
+	}
+	return s_name_registry.names[i_nameId];
+}
+
+const u32 get_names_count()
+{
+	return s_name_registry.count.load(std::memory_order_acquire);
+}
+
+}
@@ -0,0 +1,73 @@
+#include "lotus/plots.h"
+
+#include "lotus/clock.h"
+
+namespace lotus
+{
+
+void init_plot_decimator(plot_decimator_t& o_decimator, const u32 i_plotId, const f64 i_bucketMs)
+{
+	const u64 bucketTicks = (u64)(i_bucketMs / get_clock_info().ms_per_tick);
+	o_decimator.plot_id = i_plotId;
+	o_decimator.bucket_ticks = bucketTicks > 0 ? bucketTicks : 1;
+	o_decimator.bucket.time_stamp = 0;
+	o_decimator.bucket.samples_count = 0;
+	o_decimator.sum = 0.0;
+}
+
+const bool flush_plot_decimator(plot_decimator_t& io_decimator, plot_bucket_t& o_bucket)
+{
+	if (io_decimator.bucket.samples_count == 0) {
+		return false;
+	}
+	o_bucket = io_decimator.bucket;
+	o_bucket.avg = io_decimator.sum / (f64)io_decimator.bucket.samples_count;
+	io_decimator.bucket.samples_count = 0;
+	io_decimator.sum = 0.0;
+	return true;
+}
+
+const bool add_plot_event(plot_decimator_t& io_decimator, const unpacked_event& i_event, plot_bucket_t& o_bucket)
+{
+	if (i_event.kind != event_kind_e::plot || i_event.name_id != io_decimator.plot_id) {
+		return false;
+	}
+
+	const u64 bucketTimeStamp = i_event.time_stamp - i_event.time_stamp % io_decimator.bucket_ticks;
+	bool closed = false;
+	if (io_decimator.bucket.samples_count > 0 && bucketTimeStamp != io_decimator.bucket.time_stamp) {
+		closed = flush_plot_decimator(io_decimator, o_bucket);
+	}
+
+	plot_bucket_t& bucket = io_decimator.bucket;
+	if (bucket.samples_count == 0) {
+		bucket.time_stamp = bucketTimeStamp;
+		bucket.min = i_event.value;
+		bucket.max = i_event.value;
+	} else {
+		bucket.min = i_event.value < bucket.min ? i_event.value : bucket.min;
+		bucket.max = i_event.value > bucket.max ? i_event.value : bucket.max;
+	}
+	bucket.samples_count++;
+	io_decimator.sum += i_event.value;
+	return closed;
+}
+
+const u32 decimate_plot(const unpacked_event* i_events, const u32 i_eventsCount, const u32 i_plotId,
+		const f64 i_bucketMs, plot_bucket_t* o_buckets, const u32 i_capacity)
+{
+	plot_decimator_t decimator;
+	init_plot_decimator(decimator, i_plotId, i_bucketMs);
+	u32 bucketsCount = 0;
+	for (u32 i = 0; i < i_eventsCount && bucketsCount < i_capacity; i++) {
+		if (add_plot_event(decimator, i_events[i], o_buckets[bucketsCount])) {
+			bucketsCount++;
+		}
+	}
+	if (bucketsCount < i_capacity && flush_plot_decimator(decimator, o_buckets[bucketsCount])) {
+		bucketsCount++;
+	}
+	return bucketsCount;
+}
+
+}
@@ -1,11 +1,10 @@
 #include "lotus/profiler.h"
 
 #include "lotus/memory.h"
+#include "lotus/clock.h"
+#include "lotus/detail/gpu_sampler.h"
 
 #include <floral/thread/mutex.h>
-#if defined(PLATFORM_WINDOWS)
-#include <Windows.h>
-#endif
 
 #if defined(FLORAL_PLATFORM_POSIX)
 #if __ANDROID_API__ >= 23
@@ -21,12 +20,14 @@ namespace lotus
 
 namespace detail
 {
-	unpacked_event_buffer_t						s_unpacked_event_buffers[THREADS_CAP];
+	std::atomic<thread_slot_chunk_t*>			s_thread_slot_chunks[THREADS_CAP / THREAD_SLOTS_PER_CHUNK];
+	std::atomic<u32>							s_thread_slots_count(0);
+	floral::mutex								s_init_mtx;
 	thread_local capture_info					s_capture_info;
 }
 
-static sidx										s_threads_count = 0;
-static floral::mutex							s_init_mtx;
+static u32										s_default_categories = k_category_all;
+static u32										s_hardware_counter_mask = 0;					// stays 0 without hwcpipe
 #if defined(PLATFORM_POSIX)
 static bool										s_hardware_counter_ready = false;
 #endif
@@ -42,75 +43,312 @@ static void hwcpipe_free(void* i_ptr)
 	s_hwcArena->free(i_ptr);
 }
 
-void init_capture_for_this_thread(const u32 i_threadId, const_cstr i_captureName)
+// must be called with detail::s_init_mtx held
+static detail::thread_slot_t* _claim_thread_slot(u32& o_slotIdx)
+{
+	const u32 slotsCount = detail::s_thread_slots_count.load(std::memory_order_relaxed);
+	for (u32 i = 0; i < slotsCount; i++)
+	{
+		detail::thread_slot_t* slot = detail::get_thread_slot(i);
+		if (slot->state.load(std::memory_order_acquire) == (u32)detail::thread_slot_state_e::free)
+		{
+			o_slotIdx = i;
+			return slot;
+		}
+	}
+
+	if (slotsCount >= THREADS_CAP)
+	{
+		return nullptr;
+	}
+
+	const u32 chunkIdx = slotsCount / THREAD_SLOTS_PER_CHUNK;
+	if (detail::s_thread_slot_chunks[chunkIdx].load(std::memory_order_relaxed) == nullptr)
+	{
+		detail::thread_slot_chunk_t* chunk = e_main_allocator.allocate<detail::thread_slot_chunk_t>();
+		for (u32 i = 0; i < THREAD_SLOTS_PER_CHUNK; i++)
+		{
+			detail::thread_slot_t& slot = chunk->slots[i];
+			slot.state.store((u32)detail::thread_slot_state_e::free, std::memory_order_relaxed);
+			slot.generation.store(0, std::memory_order_relaxed);
+			slot.buffer.data = nullptr;
+			slot.buffer.counters = nullptr;
+			slot.buffer.compact.blocks = nullptr;
+			slot.statistics.store(nullptr, std::memory_order_relaxed);
+			slot.enabled_categories.store(0, std::memory_order_relaxed);
+		}
+		detail::s_thread_slot_chunks[chunkIdx].store(chunk, std::memory_order_release);
+	}
+
+	o_slotIdx = slotsCount;
+	detail::s_thread_slots_count.store(slotsCount + 1, std::memory_order_release);
+	return detail::get_thread_slot(slotsCount);
+}
+
+void init_capture_for_this_thread(const u32 i_threadId, const_cstr i_captureName, const storage_mode_e i_storageMode,
+		const bool i_aggregateStatistics)
 {
-	floral::lock_guard initGuard(s_init_mtx);
+	floral::lock_guard initGuard(detail::s_init_mtx);
+	u32 slotIdx = 0;
+	detail::thread_slot_t* threadSlot = _claim_thread_slot(slotIdx);
+	if (threadSlot == nullptr)
+	{
+		// out of thread slots, every scope of this thread will be dropped
+		detail::s_capture_info.event_buffer_idx = -1;
+		detail::s_capture_info.event_buffer = nullptr;
+		detail::s_capture_info.statistics = nullptr;
+		detail::s_capture_info.enabled_categories = nullptr;
+		return;
+	}
+
 	// meta data
-	detail::s_capture_info.event_buffer_idx = s_threads_count;
-	s_threads_count++;
+	detail::s_capture_info.event_buffer_idx = slotIdx;
 	detail::s_capture_info.thread_id = i_threadId;
 	strcpy(detail::s_capture_info.name, i_captureName);
-	detail::s_capture_info.event_allocator = e_main_allocator.allocate_arena<pool_allocator_t<event>>(SIZE_MB(8));
 	detail::s_capture_info.current_depth = 0;
+	threadSlot->enabled_categories.store(s_default_categories, std::memory_order_relaxed);
+	detail::s_capture_info.enabled_categories = &threadSlot->enabled_categories;
 
-	// event buffer
-	detail::unpacked_event_buffer_t& eventBuffer = detail::s_unpacked_event_buffers[detail::s_capture_info.event_buffer_idx];
-	eventBuffer.data = e_main_allocator.allocate_array<unpacked_event>(EVENTS_CAP);
-	eventBuffer.ridx = 0;
-	eventBuffer.widx = 0;
-	
-#if defined(PLATFORM_WINDOWS)
-	LARGE_INTEGER freq;
-	QueryPerformanceFrequency(&freq);
-	detail::s_capture_info.thread_frequency = freq.QuadPart;
-#else
-	detail::s_capture_info.thread_frequency = 0;
-#endif
+	// event buffer, the storage of a recycled slot is reused
+	detail::unpacked_event_buffer_t& eventBuffer = threadSlot->buffer;
+	eventBuffer.storage_mode = i_storageMode;
+	if (i_storageMode == storage_mode_e::compact)
+	{
+		detail::compact_event_buffer_t& compactBuffer = eventBuffer.compact;
+		if (compactBuffer.blocks == nullptr)
+		{
+			compactBuffer.blocks = e_main_allocator.allocate_array<detail::compact_block_t>(COMPACT_BLOCKS_CAP);
+		}
+		compactBuffer.blocks[0].committed.store(0, std::memory_order_relaxed);
+		compactBuffer.cached_rblock = 0;
+		compactBuffer.woffset = 0;
+		compactBuffer.wprev_time_stamp = 0;
+		compactBuffer.wpin_end = 0;
+		compactBuffer.roffset = 0;
+		compactBuffer.rprev_time_stamp = 0;
+		compactBuffer.rblock.store(0, std::memory_order_relaxed);
+		compactBuffer.wblock.store(0, std::memory_order_release);
+	}
+	else if (i_storageMode == storage_mode_e::fixed)
+	{
+		if (eventBuffer.data == nullptr)
+		{
+			eventBuffer.data = e_main_allocator.allocate_array<detail::event_slot_t>(EVENTS_CAP);
+		}
+		for (u32 i = 0; i < EVENTS_CAP; i++)
+		{
+			eventBuffer.data[i].sequence.store(0, std::memory_order_relaxed);
+		}
+		if (detail::s_cpu_counters_info.count > 0)
+		{
+			detail::ensure_cpu_counters_records(eventBuffer);
+		}
+	}
+	eventBuffer.cached_ridx = 0;
+	eventBuffer.overflow_policy = overflow_policy_e::drop_newest;
+	eventBuffer.dropped_count.store(0, std::memory_order_relaxed);
+	eventBuffer.overwritten_count.store(0, std::memory_order_relaxed);
+	eventBuffer.ridx.store(0, std::memory_order_relaxed);
+	eventBuffer.widx.store(0, std::memory_order_release);
+	detail::s_capture_info.event_buffer = &eventBuffer;
+
+	// the aggregates of the previous owner of a recycled slot are dropped
+	detail::s_capture_info.statistics = nullptr;
+	detail::scope_statistics_table_t* statistics = threadSlot->statistics.load(std::memory_order_relaxed);
+	if (statistics != nullptr)
+	{
+		detail::reset_scope_statistics_table(statistics);
+	}
+	if (i_aggregateStatistics)
+	{
+		if (statistics == nullptr)
+		{
+			statistics = detail::create_scope_statistics_table();
+			threadSlot->statistics.store(statistics, std::memory_order_release);
+		}
+		detail::s_capture_info.statistics = statistics;
+	}
+
+	threadSlot->thread_id = i_threadId;
+	strcpy(threadSlot->name, i_captureName);
+	threadSlot->generation.fetch_add(1, std::memory_order_relaxed);
+	threadSlot->state.store((u32)detail::thread_slot_state_e::live, std::memory_order_release);
+
+	detail::s_capture_info.thread_frequency = get_clock_info().frequency;
 }
 
 void stop_capture_for_this_thread()
 {
-	floral::lock_guard initGuard(s_init_mtx);
-	// event buffer
-	detail::unpacked_event_buffer_t& eventBuffer = detail::s_unpacked_event_buffers[detail::s_capture_info.event_buffer_idx];
-	e_main_allocator.free(eventBuffer.data);
-	eventBuffer.data = nullptr;
-	eventBuffer.ridx = 0;
-	eventBuffer.widx = 0;
-	
-	detail::s_capture_info.event_buffer_idx = 0;
-	s_threads_count--;
+	stop_cpu_counters_for_this_thread();
+	floral::lock_guard initGuard(detail::s_init_mtx);
+	if (detail::s_capture_info.event_buffer_idx >= 0)
+	{
+		// the consumer recycles the slot once it drained the remaining events
+		detail::thread_slot_t* threadSlot = detail::get_thread_slot((u32)detail::s_capture_info.event_buffer_idx);
+		threadSlot->state.store((u32)detail::thread_slot_state_e::retired, std::memory_order_release);
+	}
+
+	detail::s_capture_info.event_buffer_idx = -1;
+	detail::s_capture_info.event_buffer = nullptr;
+	detail::s_capture_info.statistics = nullptr;
 	detail::s_capture_info.thread_id = 0;
 	strcpy(detail::s_capture_info.name, "<invalid>");
-	e_main_allocator.free(detail::s_capture_info.event_allocator);
 	detail::s_capture_info.current_depth = 0;
+	detail::s_capture_info.enabled_categories = nullptr;
+}
+
+void set_enabled_categories(const u32 i_mask)
+{
+	if (detail::s_capture_info.enabled_categories)
+	{
+		detail::s_capture_info.enabled_categories->store(i_mask, std::memory_order_relaxed);
+	}
+}
+
+void set_enabled_categories_for_all_threads(const u32 i_mask)
+{
+	floral::lock_guard initGuard(detail::s_init_mtx);
+	s_default_categories = i_mask;
+	const u32 slotsCount = detail::s_thread_slots_count.load(std::memory_order_acquire);
+	for (u32 i = 0; i < slotsCount; i++)
+	{
+		detail::thread_slot_t* threadSlot = detail::get_thread_slot(i);
+		if (threadSlot->state.load(std::memory_order_acquire) == (u32)detail::thread_slot_state_e::live)
+		{
+			threadSlot->enabled_categories.store(i_mask, std::memory_order_relaxed);
+		}
+	}
+}
+
+const u32 get_enabled_categories()
+{
+	return detail::s_capture_info.enabled_categories ?
+		detail::s_capture_info.enabled_categories->load(std::memory_order_relaxed) : 0;
+}
+
+const u32 get_thread_slots_count()
+{
+	return detail::s_thread_slots_count.load(std::memory_order_acquire);
+}
+
+const bool get_thread_slot_info(const u32 i_slotIdx, u32& o_threadId, const_cstr& o_name)
+{
+	detail::thread_slot_t* threadSlot = detail::get_thread_slot(i_slotIdx);
+	if (threadSlot == nullptr
+			|| threadSlot->state.load(std::memory_order_acquire) != (u32)detail::thread_slot_state_e::live)
+	{
+		return false;
+	}
+	o_threadId = threadSlot->thread_id;
+	o_name = threadSlot->name;
+	return true;
+}
+
+void set_overflow_policy_for_this_thread(const overflow_policy_e i_policy)
+{
+	if (detail::s_capture_info.event_buffer)
+	{
+		detail::s_capture_info.event_buffer->overflow_policy = i_policy;
+	}
+}
+
+const bool get_thread_slot_overflow_stats(const u32 i_slotIdx, u64& o_droppedEvents, u64& o_overwrittenEvents)
+{
+	detail::thread_slot_t* threadSlot = detail::get_thread_slot(i_slotIdx);
+	if (threadSlot == nullptr
+			|| threadSlot->state.load(std::memory_order_acquire) == (u32)detail::thread_slot_state_e::free)
+	{
+		return false;
+	}
+	o_droppedEvents = threadSlot->buffer.dropped_count.load(std::memory_order_relaxed);
+	o_overwrittenEvents = threadSlot->buffer.overwritten_count.load(std::memory_order_relaxed);
+	return true;
 }
 
-const bool init_hardware_counters()
+const bool acquire_event_spans(const u32 i_slotIdx, event_spans_t& o_spans)
+{
+	detail::thread_slot_t* threadSlot = detail::get_thread_slot(i_slotIdx);
+	if (threadSlot == nullptr) {
+		return false;
+	}
+	const detail::thread_slot_state_e state = (detail::thread_slot_state_e)threadSlot->state.load(std::memory_order_acquire);
+	if (state == detail::thread_slot_state_e::free) {
+		return false;
+	}
+	detail::unpacked_event_buffer_t& eb = threadSlot->buffer;
+	if (eb.storage_mode != storage_mode_e::fixed) {
+		if (eb.storage_mode == storage_mode_e::none && state == detail::thread_slot_state_e::retired) {
+			detail::recycle_thread_slot(*threadSlot);
+		}
+		return false;
+	}
+
+	const u64 wpos = eb.widx.load(std::memory_order_acquire);
+	u64 rpos = eb.ridx.load(std::memory_order_relaxed);
+	if (wpos - rpos > EVENTS_CAP) {
+		// lapped by an overwriting producer, the skipped events are in overwritten_count
+		rpos = wpos - EVENTS_CAP;
+	}
+	// slots are published at end_event, the spans stop at the oldest scope still open
+	u64 endPos = rpos;
+	while (endPos != wpos && eb.data[endPos & (EVENTS_CAP - 1)].sequence.load(std::memory_order_acquire) == endPos + 1) {
+		endPos++;
+	}
+
+	o_spans.spans_count = 0;
+	o_spans.slot_idx = i_slotIdx;
+	o_spans.buffer = &eb;
+	o_spans.begin_pos = rpos;
+	o_spans.end_pos = endPos;
+	o_spans.retired = state == detail::thread_slot_state_e::retired;
+	u64 pos = rpos;
+	while (pos != endPos) {
+		const u64 wrapPos = (pos & ~(u64)(EVENTS_CAP - 1)) + EVENTS_CAP;
+		event_span_t& span = o_spans.spans[o_spans.spans_count++];
+		span.slots = &eb.data[pos & (EVENTS_CAP - 1)];
+		span.first_pos = pos;
+		span.count = (u32)((endPos < wrapPos ? endPos : wrapPos) - pos);
+		pos += span.count;
+	}
+	return true;
+}
+
+const bool commit_event_spans(const event_spans_t& i_spans)
+{
+	detail::thread_slot_t* threadSlot = detail::get_thread_slot(i_spans.slot_idx);
+	detail::unpacked_event_buffer_t& eb = threadSlot->buffer;
+	// an overwriting producer reuses the slot of position p when it reserves p + EVENTS_CAP
+	const bool intact = eb.widx.load(std::memory_order_acquire) - i_spans.begin_pos <= EVENTS_CAP;
+	eb.ridx.store(i_spans.end_pos, std::memory_order_release);
+	if (i_spans.retired) {
+		detail::recycle_thread_slot(*threadSlot);
+	}
+	return intact;
+}
+
+const bool init_hardware_counters(const u32 i_counterMask)
 {
 #if defined(PLATFORM_POSIX)
-	floral::lock_guard initGuard(s_init_mtx);
+	floral::lock_guard initGuard(detail::s_init_mtx);
 	if (s_hardware_counter_ready)
 	{
 		return true;
 	}
 	s_hwcArena = e_main_allocator.allocate_arena<freelist_arena_t>(SIZE_MB(1));
-	hwcpipe::gpu_counter_e enabledGpuCounters[] = {
-		hwcpipe::gpu_counter_e::gpu_cycles,
-		hwcpipe::gpu_counter_e::fragment_cycles,
-		hwcpipe::gpu_counter_e::tiler_cycles,
-		hwcpipe::gpu_counter_e::frag_elim,
-		hwcpipe::gpu_counter_e::tiles,
-
-		hwcpipe::gpu_counter_e::shader_texture_cycles,
-		hwcpipe::gpu_counter_e::varying_16_bits,
-		hwcpipe::gpu_counter_e::varying_32_bits,
-
-		hwcpipe::gpu_counter_e::external_memory_read_bytes,
-		hwcpipe::gpu_counter_e::external_memory_write_bytes,
-	};
+	static_assert((u32)hardware_counter_e::count == (u32)hwcpipe::gpu_counter_e::count, "hardware_counter_e must mirror hwcpipe::gpu_counter_e");
+	hwcpipe::gpu_counter_e enabledGpuCounters[(u32)hwcpipe::gpu_counter_e::count];
+	size enabledCount = 0;
+	for (u32 i = 0; i < (u32)hardware_counter_e::count; i++)
+	{
+		if (i_counterMask & (1u << i))
+		{
+			enabledGpuCounters[enabledCount] = (hwcpipe::gpu_counter_e)i;
+			enabledCount++;
+		}
+	}
+	s_hardware_counter_mask = i_counterMask & ((1u << (u32)hardware_counter_e::count) - 1);
 	hwcpipe::set_allocators(&hwcpipe_alloc, &hwcpipe_free);
-	s_hardware_counter_ready = hwcpipe::initialize_gpu_counters(enabledGpuCounters, sizeof(enabledGpuCounters) / sizeof(hwcpipe::gpu_counter_e));
+	s_hardware_counter_ready = hwcpipe::initialize_gpu_counters(enabledGpuCounters, enabledCount);
 	if (s_hardware_counter_ready)
 	{
 		hwcpipe::start();
@@ -124,133 +362,502 @@ const bool init_hardware_counters()
 void stop_hardware_counters()
 {
 #if defined(PLATFORM_POSIX)
-	floral::lock_guard initGuard(s_init_mtx);
+	stop_gpu_sampler();
+	floral::lock_guard initGuard(detail::s_init_mtx);
 	hwcpipe::stop();
 	s_hardware_counter_ready = false;
 #endif
 }
 
-void capture_counters_into(hardware_counters_t& o_counters)
+namespace detail
+{
+void sample_hardware_counters(gpu_counters_sample_t& o_sample)
 {
 #if defined(PLATFORM_POSIX)
 	hwcpipe::sample();
-	o_counters.gpu_cycles = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::gpu_cycles);
-	o_counters.fragment_cycles = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::fragment_cycles);
-	o_counters.tiler_cycles = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::tiler_cycles);
-	o_counters.frag_elim = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::frag_elim);
-	o_counters.tiles = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::tiles);
-
-	o_counters.shader_texture_cycles = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::shader_texture_cycles);
-	o_counters.varying_16_bits = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::varying_16_bits);
-	o_counters.varying_32_bits = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::varying_32_bits);
-
-	o_counters.external_memory_read_bytes = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::external_memory_read_bytes);
-	o_counters.external_memory_write_bytes = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::external_memory_write_bytes);
+	o_sample.time_stamp = read_clock();
+	o_sample.gpu_time_stamp = hwcpipe::get_sample_time_stamp();
+
+	// counters outside the set are not even read
+	for (u32 i = 0; i < (u32)hardware_counter_e::count; i++)
+	{
+		o_sample.values[i] = (s_hardware_counter_mask & (1u << i)) ?
+			hwcpipe::get_counter_value((hwcpipe::gpu_counter_e)i) : 0;
+	}
 #endif
 }
+}
 
+static const bool _capture_gpu_sample(gpu_counters_sample_t& o_sample)
+{
+#if defined(PLATFORM_POSIX)
+	if (is_gpu_sampler_running())
+	{
+		// the sampler thread owns hwcpipe, hand out its latest sample
+		return detail::peek_latest_gpu_sample(o_sample);
+	}
+	detail::sample_hardware_counters(o_sample);
+	return true;
+#else
+	return false;
+#endif
+}
+
+const u32 get_enabled_hardware_counters()
+{
+	return s_hardware_counter_mask;
+}
+
+void capture_counters_into(hardware_counters_t& o_counters)
+{
+	gpu_counters_sample_t sample;
+	if (!_capture_gpu_sample(sample))
+	{
+		return;
+	}
+	const u64* values = sample.values;
+	o_counters.gpu_cycles = (f32)values[(u32)hardware_counter_e::gpu_cycles];
+	o_counters.fragment_cycles = (f32)values[(u32)hardware_counter_e::fragment_cycles];
+	o_counters.tiler_cycles = (f32)values[(u32)hardware_counter_e::tiler_cycles];
+	o_counters.frag_elim = (f32)values[(u32)hardware_counter_e::frag_elim];
+	o_counters.tiles = (f32)values[(u32)hardware_counter_e::tiles];
+
+	o_counters.shader_texture_cycles = (f32)values[(u32)hardware_counter_e::shader_texture_cycles];
+	o_counters.varying_16_bits = (f32)values[(u32)hardware_counter_e::varying_16_bits];
+	o_counters.varying_32_bits = (f32)values[(u32)hardware_counter_e::varying_32_bits];
+
+	o_counters.external_memory_read_bytes = (f32)values[(u32)hardware_counter_e::external_memory_read_bytes];
+	o_counters.external_memory_write_bytes = (f32)values[(u32)hardware_counter_e::external_memory_write_bytes];
+}
+
+const bool capture_counters_into(hardware_counters_store_t& io_store)
+{
+	gpu_counters_sample_t sample;
+	return _capture_gpu_sample(sample) && append_counters_sample(io_store, sample);
+}
 
 void capture_and_fill_counters_into(hardware_counters_buffer_t& o_buffer, const size i_offset)
 {
 #if defined(PLATFORM_POSIX)
-	hwcpipe::sample();
-	o_buffer.gpu_cycles[i_offset] = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::gpu_cycles);
-	o_buffer.fragment_cycles[i_offset] = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::fragment_cycles);
-	o_buffer.tiler_cycles[i_offset] = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::tiler_cycles);
-	o_buffer.frag_elim[i_offset] = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::frag_elim);
-	o_buffer.tiles[i_offset] = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::tiles);
-
-	o_buffer.shader_texture_cycles[i_offset] = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::shader_texture_cycles);
-	o_buffer.varying_16_bits[i_offset] = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::varying_16_bits);
-	o_buffer.varying_32_bits[i_offset] = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::varying_32_bits);
-
-	o_buffer.external_memory_read_bytes[i_offset] = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::external_memory_read_bytes);
-	o_buffer.external_memory_write_bytes[i_offset] = (f32)hwcpipe::get_counter_value(hwcpipe::gpu_counter_e::external_memory_write_bytes);
+	hardware_counters_t counters = {};
+	capture_counters_into(counters);
+	o_buffer.gpu_cycles[i_offset] = counters.gpu_cycles;
+	o_buffer.fragment_cycles[i_offset] = counters.fragment_cycles;
+	o_buffer.tiler_cycles[i_offset] = counters.tiler_cycles;
+	o_buffer.frag_elim[i_offset] = counters.frag_elim;
+	o_buffer.tiles[i_offset] = counters.tiles;
+
+	o_buffer.shader_texture_cycles[i_offset] = counters.shader_texture_cycles;
+	o_buffer.varying_16_bits[i_offset] = counters.varying_16_bits;
+	o_buffer.varying_32_bits[i_offset] = counters.varying_32_bits;
+
+	o_buffer.external_memory_read_bytes[i_offset] = counters.external_memory_read_bytes;
+	o_buffer.external_memory_write_bytes[i_offset] = counters.external_memory_write_bytes;
 #endif
 }
 
-event* allocate_event() {
-	event* newEvent = detail::s_capture_info.event_allocator->allocate<event>();
-	return newEvent;
+const s64 _reserve_unpacked_event() {
+	if (detail::s_capture_info.event_buffer == nullptr) {
+		return -1;
+	}
+	detail::unpacked_event_buffer_t& eb = *detail::s_capture_info.event_buffer;
+	if (eb.storage_mode != storage_mode_e::fixed) {
+		// compact records are appended in end_event, once the duration is known
+		return 0;
+	}
+	const u64 wpos = eb.widx.load(std::memory_order_relaxed);
+	if (wpos >= EVENTS_CAP && detail::s_trigger_pin_end.load(std::memory_order_relaxed) != 0) {
+		// the slot to reuse may hold an event of a fired trigger's window, keep it for process_trigger
+		const detail::event_slot_t& slot = eb.data[wpos & (EVENTS_CAP - 1)];
+		if (slot.sequence.load(std::memory_order_relaxed) == wpos - EVENTS_CAP + 1
+				&& detail::is_pinned_by_trigger(slot.data.time_stamp, detail::get_record_end_time_stamp(slot.data))) {
+			detail::add_to_counter(eb.dropped_count);
+			return -1;
+		}
+	}
+	if (wpos - eb.cached_ridx >= EVENTS_CAP) {
+		// only touch the consumer's cache line when the ring looks full, and only now and then
+		// while overwriting: the consumer is then assumed to stay behind
+		if (eb.overflow_policy == overflow_policy_e::drop_newest || (wpos & (OVERWRITE_RECHECK_EVENTS - 1)) == 0) {
+			eb.cached_ridx = eb.ridx.load(std::memory_order_acquire);
+		}
+		if (wpos - eb.cached_ridx >= EVENTS_CAP) {
+			if (eb.overflow_policy == overflow_policy_e::drop_newest) {
+				detail::add_to_counter(eb.dropped_count);
+				return -1;
+			}
+			detail::add_to_counter(eb.overwritten_count);
+			eb.cached_ridx = wpos + 1 - EVENTS_CAP;
+		}
+	}
+	if (wpos >= EVENTS_CAP) {
+		// a lapped consumer or the trigger dump may be copying the previous event of the slot right
+		// now, whatever the policy: invalidate it before end_event writes over it, read_event_slot
+		// then rejects the copy
+		eb.data[wpos & (EVENTS_CAP - 1)].sequence.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+	// the slot stays unpublished until end_event
+	eb.widx.store(wpos + 1, std::memory_order_release);
+	return (s64)wpos;
+}
+
+// i_bits is the bit pattern of the value: counts and sizes, the usual plot values, are integral and
+// stored as small zigzag varints, anything else as the raw 8 bytes
+static u8* _write_compact_plot_value(u8* o_data, const u64 i_bits)
+{
+	f64 value;
+	memcpy(&value, &i_bits, sizeof(f64));
+	// false for nan too
+	const bool integral = value >= -9007199254740992.0 && value <= 9007199254740992.0 && (f64)(s64)value == value;
+	if (integral) {
+		o_data = detail::write_varint(o_data, detail::zigzag_encode((s64)value));
+	} else {
+		o_data = detail::write_varint(o_data, i_bits);
+	}
+	return detail::write_varint(o_data, ((u64)event_kind_e::plot << 2) | (integral ? 0 : 1));
 }
 
-const sidx _reserve_unpacked_event() {
-	detail::unpacked_event_buffer_t& eb = detail::s_unpacked_event_buffers[detail::s_capture_info.event_buffer_idx];
-	floral::lock_guard captureGuard(eb.mtx);
-	sidx nextWriteIdx = (eb.widx + 1) % EVENTS_CAP;
-	if (nextWriteIdx != eb.ridx) {
-		sidx reserveIdx = eb.widx;
-		eb.data[reserveIdx].ready = false;
+static const bool _write_compact_event(detail::compact_event_buffer_t& cb, const event* i_event, const event_kind_e i_kind,
+		const counted_event* i_counted)
+{
+	u64 wblock = cb.wblock.load(std::memory_order_relaxed);
+	if (cb.woffset + detail::k_compact_record_max_size > sizeof(detail::compact_block_t::data)) {
+		const u64 nextBlock = wblock + 1;
+		if (nextBlock - cb.cached_rblock >= COMPACT_BLOCKS_CAP) {
+			cb.cached_rblock = cb.rblock.load(std::memory_order_acquire);
+			if (nextBlock - cb.cached_rblock >= COMPACT_BLOCKS_CAP) {
+				return false;
+			}
+		}
+		detail::compact_block_t& nextBlockData = cb.blocks[nextBlock & (COMPACT_BLOCKS_CAP - 1)];
+		const u64 pinEnd = detail::s_trigger_pin_end.load(std::memory_order_relaxed);
+		if (nextBlock >= COMPACT_BLOCKS_CAP && pinEnd != 0) {
+			// the block to reuse may hold events of a fired trigger's window, keep it for
+			// process_trigger. Decoded once per pin, a pinned block drops everything until then
+			if (cb.wpin_end != pinEnd) {
+				bool pinned = false;
+				auto checkPin = [&pinned](const unpacked_event& i_event) {
+					pinned |= detail::is_pinned_by_trigger(i_event.time_stamp, i_event.time_stamp + i_event.duration_ticks);
+				};
+				detail::visit_compact_block(nextBlockData.data, nextBlockData.committed.load(std::memory_order_relaxed),
+						nextBlockData.base_time_stamp, checkPin);
+				cb.wpin_end = pinned ? pinEnd : 0;
+			}
+			if (cb.wpin_end == pinEnd) {
+				return false;
+			}
+		}
+		// the consumer released this block, only the trigger dump may still be copying it: a copy
+		// that sees any of the writes below also sees the new wblock, and is then thrown away
+		nextBlockData.committed.store(0, std::memory_order_relaxed);
+		cb.woffset = 0;
+		cb.wblock.store(nextBlock, std::memory_order_release);
+		std::atomic_thread_fence(std::memory_order_release);
+		wblock = nextBlock;
+	}
 
-		eb.widx = nextWriteIdx;
-		return reserveIdx;
+	detail::compact_block_t& block = cb.blocks[wblock & (COMPACT_BLOCKS_CAP - 1)];
+	if (cb.woffset == 0) {
+		block.base_time_stamp = i_event->time_stamp;
+		cb.wprev_time_stamp = i_event->time_stamp;
 	}
-	return -1;
+
+	u8* p = block.data + cb.woffset;
+	p = detail::write_varint(p, i_event->name_id);
+	p = detail::write_varint(p, detail::zigzag_encode((s64)(i_event->time_stamp - cb.wprev_time_stamp)));
+	if (i_kind == event_kind_e::plot) {
+		p = _write_compact_plot_value(p, i_event->duration_ticks);
+		cb.wprev_time_stamp = i_event->time_stamp;
+		cb.woffset = (u32)(p - block.data);
+		block.committed.store(cb.woffset, std::memory_order_release);
+		return true;
+	}
+	p = detail::write_varint(p, i_event->duration_ticks);
+	// unsampled and uncounted events, the vast majority, do not pay for a weight or counters
+	const bool weighted = i_event->weight != 1;
+	const bool counted = i_counted != nullptr;
+	p = detail::write_varint(p, ((u64)i_event->depth << 6) | ((u64)i_kind << 2) | ((u64)counted << 1) | (u64)weighted);
+	if (weighted) {
+		p = detail::write_varint(p, i_event->weight);
+	}
+	if (counted) {
+		p = detail::write_varint(p, i_counted->cpu_counter_mask);
+		for (u32 i = 0; i < detail::s_cpu_counters_info.count; i++) {
+			p = detail::write_varint(p, i_counted->cpu_counters[i]);
+		}
+	}
+	cb.wprev_time_stamp = i_event->time_stamp;
+	cb.woffset = (u32)(p - block.data);
+	block.committed.store(cb.woffset, std::memory_order_release);
+	return true;
 }
 
-void begin_event(event* i_event, const_cstr i_name)
+static void _write_fixed_event(detail::unpacked_event_buffer_t& eb, const event* i_event, const event_kind_e i_kind,
+		const counted_event* i_counted)
+{
+	const u64 wpos = (u64)i_event->widx;
+	if (eb.widx.load(std::memory_order_relaxed) - wpos > EVENTS_CAP) {
+		// the scope stayed open for a whole lap of an overwriting ring, its slot now
+		// belongs to a newer event (already accounted for when the slot was reused)
+		return;
+	}
+	detail::event_slot_t& slot = eb.data[wpos & (EVENTS_CAP - 1)];
+	detail::event_record_t& eve = slot.data;
+	eve.time_stamp = i_event->time_stamp;
+	eve.duration_ticks = i_event->duration_ticks;
+	eve.name_id = (u16)i_event->name_id;
+	eve.depth = (u16)((i_event->depth & detail::k_depth_mask) | ((u32)i_kind << detail::k_kind_depth_shift));
+	eve.weight = i_event->weight;
+	if (i_counted && eb.counters) {
+		// published by the same sequence store
+		detail::cpu_counters_record_t& counters = eb.counters[wpos & (EVENTS_CAP - 1)];
+		counters.mask = i_counted->cpu_counter_mask;
+		for (u32 i = 0; i < CPU_COUNTERS_CAP; i++) {
+			counters.values[i] = i_counted->cpu_counters[i];
+		}
+		eve.depth |= detail::k_counted_depth_bit;
+	}
+	slot.sequence.store(wpos + 1, std::memory_order_release);
+}
+
+void begin_event(event* i_event, const u32 i_nameId, const u32 i_weight)
 {
 #if defined(FLORAL_PLATFORM_POSIX)
 #if __ANDROID_API__ >= 23
-	ATrace_beginSection(i_name);
+	ATrace_beginSection(get_name(i_nameId));
 #endif
 #endif
-	sidx widx = _reserve_unpacked_event();
+	s64 widx = _reserve_unpacked_event();
+	i_event->widx = widx;
 	if (widx >= 0) {
 		detail::s_capture_info.current_depth++;
-#if defined(PLATFORM_WINDOWS)
-		LARGE_INTEGER tp;
-		QueryPerformanceCounter(&tp);
-		i_event->time_stamp = tp.QuadPart;
-#else
-		i_event->time_stamp = 0;
-#endif
+		i_event->time_stamp = detail::read_clock();
 		i_event->depth = detail::s_capture_info.current_depth;
-		strcpy(i_event->name, i_name);
-		i_event->widx = widx;
+		i_event->name_id = i_nameId;
+		i_event->weight = i_weight;
+		if (i_event->depth <= ALLOCATION_SCOPES_CAP) {
+			detail::s_capture_info.scope_name_ids[i_event->depth - 1] = (u16)i_nameId;
+		}
 	}
 }
 
-void end_event(event* i_event)
+void begin_event(event* i_event, const_cstr i_name)
+{
+	begin_event(i_event, register_name(i_name));
+}
+
+// i_counted carries the counter deltas of a counted event, nullptr otherwise
+static void _end_event(event* i_event, const counted_event* i_counted)
 {
 #if defined(FLORAL_PLATFORM_POSIX)
 #if __ANDROID_API__ >= 23
 	ATrace_endSection();
 #endif
 #endif
-	if (i_event->widx >= 0) {
-#if defined(PLATFORM_WINDOWS)			
-		LARGE_INTEGER tp;
-		QueryPerformanceCounter(&tp);
-		i_event->duration_ticks = tp.QuadPart - i_event->time_stamp;
-		i_event->duration_ms = (f64)(tp.QuadPart - i_event->time_stamp) * 1000 / (f64)detail::s_capture_info.thread_frequency;
-#else
-		i_event->duration_ticks = 0;
-		i_event->duration_ms = 0;
-#endif
+	// a scope still open across stop_capture_for_this_thread has no buffer left to go to
+	if (i_event->widx >= 0 && detail::s_capture_info.event_buffer != nullptr) {
+		i_event->duration_ticks = detail::read_clock() - i_event->time_stamp;
 		detail::s_capture_info.current_depth--;
 
-		detail::unpacked_event_buffer_t& eb = detail::s_unpacked_event_buffers[detail::s_capture_info.event_buffer_idx];
-		unpacked_event& eve = eb.data[i_event->widx];
-		eve.time_stamp = i_event->time_stamp;
-		eve.duration_ticks = i_event->duration_ticks;
-		eve.duration_ms = i_event->duration_ms;
-		eve.depth = i_event->depth;
-		strcpy(eve.name, i_event->name);
-		eve.ready = true;
+		if (detail::s_capture_info.statistics) {
+			detail::record_scope_statistics(detail::s_capture_info.statistics, i_event->name_id, i_event->duration_ticks,
+					i_event->weight);
+		}
+
+		detail::unpacked_event_buffer_t& eb = *detail::s_capture_info.event_buffer;
+		if (eb.storage_mode == storage_mode_e::compact) {
+			// compact blocks are always drop-newest
+			if (!_write_compact_event(eb.compact, i_event, event_kind_e::scope, i_counted)) {
+				detail::add_to_counter(eb.dropped_count);
+			}
+		} else if (eb.storage_mode == storage_mode_e::fixed) {
+			_write_fixed_event(eb, i_event, event_kind_e::scope, i_counted);
+		}
+
+		// after publishing, so the window pinned by fire_trigger contains the slow scope itself
+		if (i_event->name_id == detail::s_trigger_name_id.load(std::memory_order_relaxed)
+				&& i_event->duration_ticks > detail::s_trigger_threshold_ticks.load(std::memory_order_relaxed)) {
+			detail::fire_trigger(i_event->name_id, i_event->time_stamp + i_event->duration_ticks, i_event->duration_ticks);
+		}
 	}
 }
 
+void end_event(event* i_event)
+{
+	_end_event(i_event, nullptr);
+}
+
+void begin_event(counted_event* i_event, const u32 i_nameId, const u32 i_weight)
+{
+	begin_event(&i_event->base, i_nameId, i_weight);
+	i_event->cpu_counter_mask = 0;
+	if (i_event->base.widx >= 0 && detail::s_cpu_counters_info.count > 0) {
+		// last, so that the counters do not see our own bookkeeping
+		i_event->cpu_counter_mask = detail::s_cpu_counters_info.mask;
+		detail::read_cpu_counters(i_event->cpu_counters);
+	}
+}
+
+void end_event(counted_event* i_event)
+{
+	// the counter set was replaced while the scope was open, its begin values are meaningless
+	if (i_event->cpu_counter_mask == 0 || i_event->cpu_counter_mask != detail::s_cpu_counters_info.mask) {
+		_end_event(&i_event->base, nullptr);
+		return;
+	}
+
+	u64 counters[CPU_COUNTERS_CAP];
+	detail::read_cpu_counters(counters);
+	for (u32 i = 0; i < detail::s_cpu_counters_info.count; i++) {
+		i_event->cpu_counters[i] = counters[i] - i_event->cpu_counters[i];
+	}
+	_end_event(&i_event->base, i_event);
+}
+
 // -----------------------------------------
-profile_scope::profile_scope(event* i_event, const_cstr i_name)
-	: pevent(i_event)
+// allocations and plot values are instantaneous records, they reuse the duration field for their payload.
+// Records of other kinds whose begin and end are both known when they are written go through here too.
+
+static void _write_record(detail::unpacked_event_buffer_t& eb, const event_kind_e i_kind, const u32 i_nameId,
+		const u32 i_depth, const u64 i_timeStamp, const u64 i_payload, const u32 i_weight)
 {
-	begin_event(pevent, i_name);
+	if (eb.storage_mode == storage_mode_e::none) {
+		return;
+	}
+	event eve;
+	eve.widx = _reserve_unpacked_event();
+	if (eve.widx < 0) {
+		return;
+	}
+	eve.time_stamp = i_timeStamp;
+	eve.duration_ticks = i_payload;
+	eve.depth = i_depth;
+	eve.name_id = i_nameId;
+	eve.weight = i_weight;
+	if (eb.storage_mode == storage_mode_e::compact) {
+		if (!_write_compact_event(eb.compact, &eve, i_kind, nullptr)) {
+			detail::add_to_counter(eb.dropped_count);
+		}
+	} else {
+		_write_fixed_event(eb, &eve, i_kind, nullptr);
+	}
+}
+
+static const u32 _get_innermost_scope_name_id(const detail::capture_info& i_captureInfo)
+{
+	const u32 depth = i_captureInfo.current_depth;
+	return depth == 0 ? k_invalid_name_id
+		: i_captureInfo.scope_name_ids[(depth < ALLOCATION_SCOPES_CAP ? depth : ALLOCATION_SCOPES_CAP) - 1];
+}
+
+// attributed to the innermost open scope
+static void _record_allocation_event(const event_kind_e i_kind, const u32 i_allocatorId, const u64 i_size)
+{
+	detail::capture_info& captureInfo = detail::s_capture_info;
+	if (captureInfo.event_buffer == nullptr) {
+		return;
+	}
+
+	const u32 depth = captureInfo.current_depth;
+	const u32 scopeNameId = _get_innermost_scope_name_id(captureInfo);
+	if (captureInfo.statistics) {
+		detail::record_allocation_statistics(captureInfo.statistics, scopeNameId, i_size, i_kind == event_kind_e::free);
+	}
+
+	_write_record(*captureInfo.event_buffer, i_kind, scopeNameId, depth, detail::read_clock(), i_size, i_allocatorId);
+}
+
+void record_allocation(const u32 i_allocatorId, const u64 i_size)
+{
+	_record_allocation_event(event_kind_e::allocation, i_allocatorId, i_size);
+}
+
+void record_free(const u32 i_allocatorId, const u64 i_size)
+{
+	_record_allocation_event(event_kind_e::free, i_allocatorId, i_size);
+}
+
+const u32 get_global_allocator_id()
+{
+	static const u32 s_global_allocator_id = register_allocator("global");
+	return s_global_allocator_id;
+}
+
+// async events may begin and end on different threads, each half goes into the ring of the thread
+// that records it and the halves are matched by id when unpacked (see flow_tracker_t)
+static void _record_async_event(const event_kind_e i_kind, const u32 i_nameId, const u64 i_id)
+{
+	detail::capture_info& captureInfo = detail::s_capture_info;
+	if (captureInfo.event_buffer == nullptr) {
+		return;
+	}
+	_write_record(*captureInfo.event_buffer, i_kind, i_nameId, captureInfo.current_depth, detail::read_clock(), i_id, 1);
+}
+
+void begin_async_event(const u32 i_nameId, const u64 i_id)
+{
+	_record_async_event(event_kind_e::async_begin, i_nameId, i_id);
+}
+
+void end_async_event(const u32 i_nameId, const u64 i_id)
+{
+	_record_async_event(event_kind_e::async_end, i_nameId, i_id);
+}
+
+void record_flow_start(const u64 i_id)
+{
+	_record_async_event(event_kind_e::flow_start, _get_innermost_scope_name_id(detail::s_capture_info), i_id);
+}
+
+void record_flow_end(const u64 i_id)
+{
+	_record_async_event(event_kind_e::flow_end, _get_innermost_scope_name_id(detail::s_capture_info), i_id);
+}
+
+namespace detail
+{
+void record_lock_event(const event_kind_e i_kind, const u32 i_lockId, const u64 i_timeStamp, const u64 i_durationTicks,
+		const u32 i_ownerThreadId)
+{
+	capture_info& captureInfo = s_capture_info;
+	if (captureInfo.event_buffer == nullptr) {
+		return;
+	}
+	_write_record(*captureInfo.event_buffer, i_kind, i_lockId, captureInfo.current_depth + 1, i_timeStamp, i_durationTicks,
+			i_ownerThreadId);
+}
+}
+
+void plot(const u32 i_plotId, const f64 i_value)
+{
+	detail::capture_info& captureInfo = detail::s_capture_info;
+	if (captureInfo.event_buffer == nullptr) {
+		return;
+	}
+	u64 bits;
+	memcpy(&bits, &i_value, sizeof(f64));
+	_write_record(*captureInfo.event_buffer, event_kind_e::plot, i_plotId, 0, detail::read_clock(), bits, 1);
+}
+
+// -----------------------------------------
+profile_scope::profile_scope(const u32 i_nameId)
+{
+	begin_event(&scope_event, i_nameId);
 }
 
 profile_scope::~profile_scope()
 {
-	end_event(pevent);
+	if (scope_event.widx != detail::k_scope_disabled) {
+		end_event(&scope_event);
+	}
+}
+
+counted_profile_scope::~counted_profile_scope()
+{
+	if (scope_event.base.widx != detail::k_scope_disabled) {
+		end_event(&scope_event);
+	}
 }
 
 }
@@ -0,0 +1,219 @@
+#include "lotus/statistics.h"
+
+#include "lotus/memory.h"
+#include "lotus/clock.h"
+#include "lotus/names.h"
+#include "lotus/detail/profiler.h"
+#include "lotus/detail/statistics.h"
+
+namespace lotus
+{
+
+namespace detail
+{
+
+static void reset_scope_statistics_entry(scope_statistics_entry_t& o_entry)
+{
+	o_entry.count.store(0, std::memory_order_relaxed);
+	o_entry.total_ticks.store(0, std::memory_order_relaxed);
+	o_entry.min_ticks.store(~0ull, std::memory_order_relaxed);
+	o_entry.max_ticks.store(0, std::memory_order_relaxed);
+	for (u32 i = 0; i < k_histogram_buckets_count; i++)
+	{
+		o_entry.buckets[i].store(0, std::memory_order_relaxed);
+	}
+	o_entry.allocations_count.store(0, std::memory_order_relaxed);
+	o_entry.allocated_bytes.store(0, std::memory_order_relaxed);
+	o_entry.frees_count.store(0, std::memory_order_relaxed);
+	o_entry.freed_bytes.store(0, std::memory_order_relaxed);
+}
+
+scope_statistics_table_t* create_scope_statistics_table()
+{
+	scope_statistics_table_t* table = e_main_allocator.allocate<scope_statistics_table_t>();
+	for (u32 i = 0; i < NAMES_CAP; i++)
+	{
+		table->entries[i].store(nullptr, std::memory_order_relaxed);
+	}
+	table->pool = e_main_allocator.allocate_array<scope_statistics_entry_t>(STATISTICS_ENTRIES_CAP);
+	table->pool_used = 0;
+	return table;
+}
+
+void reset_scope_statistics_table(scope_statistics_table_t* i_table)
+{
+	for (u32 i = 0; i < i_table->pool_used; i++)
+	{
+		reset_scope_statistics_entry(i_table->pool[i]);
+	}
+}
+
+static scope_statistics_entry_t* get_scope_statistics_entry(scope_statistics_table_t* i_table, const u32 i_nameId)
+{
+	scope_statistics_entry_t* entry = i_table->entries[i_nameId].load(std::memory_order_relaxed);
+	if (entry == nullptr)
+	{
+		if (i_table->pool_used >= STATISTICS_ENTRIES_CAP)
+		{
+			return nullptr;
+		}
+		entry = &i_table->pool[i_table->pool_used];
+		i_table->pool_used++;
+		reset_scope_statistics_entry(*entry);
+		i_table->entries[i_nameId].store(entry, std::memory_order_release);
+	}
+	return entry;
+}
+
+void record_scope_statistics(scope_statistics_table_t* i_table, const u32 i_nameId, const u64 i_durationTicks,
+		const u32 i_weight)
+{
+	scope_statistics_entry_t* entry = get_scope_statistics_entry(i_table, i_nameId);
+	if (entry == nullptr)
+	{
+		return;
+	}
+
+	// we are the only writer: plain load + store, no read-modify-write.
+	// A sampled event stands for i_weight invocations of the same duration
+	entry->count.store(entry->count.load(std::memory_order_relaxed) + i_weight, std::memory_order_relaxed);
+	entry->total_ticks.store(entry->total_ticks.load(std::memory_order_relaxed) + i_durationTicks * i_weight,
+			std::memory_order_relaxed);
+	if (i_durationTicks < entry->min_ticks.load(std::memory_order_relaxed))
+	{
+		entry->min_ticks.store(i_durationTicks, std::memory_order_relaxed);
+	}
+	if (i_durationTicks > entry->max_ticks.load(std::memory_order_relaxed))
+	{
+		entry->max_ticks.store(i_durationTicks, std::memory_order_relaxed);
+	}
+	std::atomic<u64>& bucket = entry->buckets[get_histogram_bucket(i_durationTicks)];
+	bucket.store(bucket.load(std::memory_order_relaxed) + i_weight, std::memory_order_relaxed);
+}
+
+void record_allocation_statistics(scope_statistics_table_t* i_table, const u32 i_nameId, const u64 i_size,
+		const bool i_free)
+{
+	scope_statistics_entry_t* entry = get_scope_statistics_entry(i_table, i_nameId);
+	if (entry == nullptr)
+	{
+		return;
+	}
+
+	std::atomic<u64>& count = i_free ? entry->frees_count : entry->allocations_count;
+	std::atomic<u64>& bytes = i_free ? entry->freed_bytes : entry->allocated_bytes;
+	count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	bytes.store(bytes.load(std::memory_order_relaxed) + i_size, std::memory_order_relaxed);
+}
+
+}
+
+// -----------------------------------------
+
+// i_bucketsTotal is the sum of i_buckets: the buckets are read after count and may lag behind it
+static const f64 get_percentile_ms(const u64* i_buckets, const u64 i_bucketsTotal, const f64 i_percentile)
+{
+	const u64 target = (u64)((f64)i_bucketsTotal * i_percentile);
+	u64 cumulative = 0;
+	for (u32 i = 0; i < detail::k_histogram_buckets_count; i++)
+	{
+		cumulative += i_buckets[i];
+		if (cumulative > target)
+		{
+			return detail::get_histogram_bucket_value(i) * get_clock_info().ms_per_tick;
+		}
+	}
+	return 0.0;
+}
+
+const u32 collect_scope_statistics(scope_statistics_t* o_statistics, const u32 i_capacity)
+{
+	u64 buckets[detail::k_histogram_buckets_count];
+	const u32 namesCount = get_names_count();
+	const u32 slotsCount = detail::s_thread_slots_count.load(std::memory_order_acquire);
+	const f64 msPerTick = get_clock_info().ms_per_tick;
+
+	u32 statsCount = 0;
+	for (u32 nameId = 1; nameId < namesCount && statsCount < i_capacity; nameId++)
+	{
+		scope_statistics_t& stats = o_statistics[statsCount];
+		stats.count = 0;
+		stats.total_ticks = 0;
+		stats.min_ticks = ~0ull;
+		stats.max_ticks = 0;
+		stats.allocations_count = 0;
+		stats.allocated_bytes = 0;
+		stats.frees_count = 0;
+		stats.freed_bytes = 0;
+		memset(buckets, 0, sizeof(buckets));
+
+		for (u32 slotIdx = 0; slotIdx < slotsCount; slotIdx++)
+		{
+			detail::thread_slot_t* threadSlot = detail::get_thread_slot(slotIdx);
+			detail::scope_statistics_table_t* table = threadSlot->statistics.load(std::memory_order_acquire);
+			if (table == nullptr)
+			{
+				continue;
+			}
+			const detail::scope_statistics_entry_t* entry = table->entries[nameId].load(std::memory_order_acquire);
+			if (entry == nullptr)
+			{
+				continue;
+			}
+
+			stats.count += entry->count.load(std::memory_order_relaxed);
+			stats.total_ticks += entry->total_ticks.load(std::memory_order_relaxed);
+			const u64 minTicks = entry->min_ticks.load(std::memory_order_relaxed);
+			const u64 maxTicks = entry->max_ticks.load(std::memory_order_relaxed);
+			stats.min_ticks = minTicks < stats.min_ticks ? minTicks : stats.min_ticks;
+			stats.max_ticks = maxTicks > stats.max_ticks ? maxTicks : stats.max_ticks;
+			for (u32 i = 0; i < detail::k_histogram_buckets_count; i++)
+			{
+				buckets[i] += entry->buckets[i].load(std::memory_order_relaxed);
+			}
+			stats.allocations_count += entry->allocations_count.load(std::memory_order_relaxed);
+			stats.allocated_bytes += entry->allocated_bytes.load(std::memory_order_relaxed);
+			stats.frees_count += entry->frees_count.load(std::memory_order_relaxed);
+			stats.freed_bytes += entry->freed_bytes.load(std::memory_order_relaxed);
+		}
+
+		// a scope that is still open may only have allocations so far
+		if (stats.count == 0 && stats.allocations_count == 0 && stats.frees_count == 0)
+		{
+			continue;
+		}
+
+		if (stats.count == 0)
+		{
+			stats.min_ticks = 0;
+		}
+		stats.name_id = nameId;
+		stats.name = get_name(nameId);
+		stats.total_ms = (f64)stats.total_ticks * msPerTick;
+		stats.mean_ms = stats.count > 0 ? stats.total_ms / (f64)stats.count : 0.0;
+		stats.min_ms = (f64)stats.min_ticks * msPerTick;
+		stats.max_ms = (f64)stats.max_ticks * msPerTick;
+		u64 bucketsTotal = 0;
+		for (u32 i = 0; i < detail::k_histogram_buckets_count; i++)
+		{
+			bucketsTotal += buckets[i];
+		}
+		stats.p50_ms = get_percentile_ms(buckets, bucketsTotal, 0.50);
+		stats.p95_ms = get_percentile_ms(buckets, bucketsTotal, 0.95);
+		stats.p99_ms = get_percentile_ms(buckets, bucketsTotal, 0.99);
+		statsCount++;
+	}
+	return statsCount;
+}
+
+void reset_scope_statistics_for_this_thread()
+{
+	detail::scope_statistics_table_t* table = detail::s_capture_info.statistics;
+	if (table == nullptr)
+	{
+		return;
+	}
+	detail::reset_scope_statistics_table(table);
+}
+
+}
@@ -0,0 +1,357 @@
+#include "lotus/timeline.h"
+
+#include "lotus/profiler.h"
+#include "lotus/memory.h"
+
+#if defined(PLATFORM_POSIX)
+#include <sched.h>
+#endif
+
+namespace lotus
+{
+
+static inline const bool _is_key_less(const timeline_key_t& i_a, const timeline_key_t& i_b)
+{
+	return i_a.time_stamp < i_b.time_stamp;
+}
+
+// the streams are nearly sorted: fixed storage is in begin order, compact storage in completion
+// order (a scope only moves back past its own children)
+static void _sort_stream(timeline_key_t* io_keys, const u32 i_count)
+{
+	for (u32 i = 1; i < i_count; i++) {
+		const timeline_key_t key = io_keys[i];
+		u32 j = i;
+		for (; j > 0 && _is_key_less(key, io_keys[j - 1]); j--) {
+			io_keys[j] = io_keys[j - 1];
+		}
+		io_keys[j] = key;
+	}
+}
+
+// first key of the stream whose time stamp is >= i_timeStamp
+static const u32 _lower_bound(const timeline_key_t* i_keys, const timeline_stream_t& i_stream, const u64 i_timeStamp)
+{
+	u32 lo = i_stream.begin;
+	u32 hi = i_stream.end;
+	while (lo < hi) {
+		const u32 mid = lo + (hi - lo) / 2;
+		if (i_keys[mid].time_stamp < i_timeStamp) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static const u32 _count_before(const timeline_merger_t& i_merger, const u64 i_timeStamp)
+{
+	u32 count = 0;
+	for (u32 i = 0; i < i_merger.streams_count; i++) {
+		const timeline_stream_t& stream = i_merger.streams[i];
+		count += _lower_bound(i_merger.keys, stream, i_timeStamp) - stream.begin;
+	}
+	return count;
+}
+
+// -----------------------------------------
+struct merge_cursor_t {
+	u32											pos;
+	u32											end;
+	u32											stream_idx;
+};
+
+// ties go to the lower thread slot, so that a merge is deterministic
+static inline const bool _is_cursor_less(const timeline_key_t* i_keys, const merge_cursor_t& i_a, const merge_cursor_t& i_b)
+{
+	const u64 a = i_keys[i_a.pos].time_stamp;
+	const u64 b = i_keys[i_b.pos].time_stamp;
+	return a < b || (a == b && i_a.stream_idx < i_b.stream_idx);
+}
+
+static void _sift_down(const timeline_key_t* i_keys, merge_cursor_t* io_heap, const u32 i_count, u32 i_idx)
+{
+	while (true) {
+		const u32 left = i_idx * 2 + 1;
+		if (left >= i_count) {
+			return;
+		}
+		u32 smallest = left;
+		if (left + 1 < i_count && _is_cursor_less(i_keys, io_heap[left + 1], io_heap[left])) {
+			smallest = left + 1;
+		}
+		if (!_is_cursor_less(i_keys, io_heap[smallest], io_heap[i_idx])) {
+			return;
+		}
+		const merge_cursor_t tmp = io_heap[i_idx];
+		io_heap[i_idx] = io_heap[smallest];
+		io_heap[smallest] = tmp;
+		i_idx = smallest;
+	}
+}
+
+// k-way heap merge of the part of every stream that falls in the window
+static void _merge_window(timeline_merger_t& io_merger, const u32 i_windowIdx)
+{
+	timeline_window_t& window = io_merger.windows[i_windowIdx];
+	const bool last = i_windowIdx + 1 == io_merger.windows_count;
+	const u64 endTimeStamp = last ? 0 : io_merger.windows[i_windowIdx + 1].begin_time_stamp;
+
+	merge_cursor_t heap[THREADS_CAP];
+	u32 heapCount = 0;
+	for (u32 i = 0; i < io_merger.streams_count; i++) {
+		const timeline_stream_t& stream = io_merger.streams[i];
+		merge_cursor_t cursor;
+		cursor.pos = i_windowIdx == 0 ? stream.begin : _lower_bound(io_merger.keys, stream, window.begin_time_stamp);
+		cursor.end = last ? stream.end : _lower_bound(io_merger.keys, stream, endTimeStamp);
+		cursor.stream_idx = i;
+		if (cursor.pos < cursor.end) {
+			heap[heapCount++] = cursor;
+		}
+	}
+	for (u32 i = heapCount / 2; i > 0; i--) {
+		_sift_down(io_merger.keys, heap, heapCount, i - 1);
+	}
+
+	const f64 nsPerTick = get_clock_info().ns_per_tick;
+	merged_event_t* output = io_merger.output + window.output_offset;
+	while (heapCount > 0) {
+		merge_cursor_t& top = heap[0];
+		const timeline_key_t& key = io_merger.keys[top.pos];
+		output->event = &io_merger.events[key.event_idx];
+		output->thread_slot = io_merger.streams[top.stream_idx].thread_slot;
+		output->time_ns = (s64)((f64)(s64)(key.time_stamp - io_merger.epoch) * nsPerTick);
+		output++;
+		top.pos++;
+		if (top.pos == top.end) {
+			heap[0] = heap[--heapCount];
+		}
+		_sift_down(io_merger.keys, heap, heapCount, 0);
+	}
+	window.done.store(1, std::memory_order_release);
+}
+
+// -----------------------------------------
+// sorts the streams, then merges the windows: the two phases of a parallel merge share the
+// claiming scheme, an index handed out by next_window
+static void _sort_streams(timeline_merger_t& io_merger)
+{
+	while (true) {
+		const u32 streamIdx = io_merger.next_window.fetch_add(1, std::memory_order_relaxed);
+		if (streamIdx >= io_merger.streams_count) {
+			return;
+		}
+		const timeline_stream_t& stream = io_merger.streams[streamIdx];
+		_sort_stream(io_merger.keys + stream.begin, stream.end - stream.begin);
+	}
+}
+
+static void _merge_windows(timeline_merger_t& io_merger)
+{
+	while (true) {
+		const u32 windowIdx = io_merger.next_window.fetch_add(1, std::memory_order_relaxed);
+		if (windowIdx >= io_merger.windows_count) {
+			return;
+		}
+		_merge_window(io_merger, windowIdx);
+	}
+}
+
+#if defined(PLATFORM_POSIX)
+static void* _sort_worker_main(void* i_merger)
+{
+	_sort_streams(*(timeline_merger_t*)i_merger);
+	return nullptr;
+}
+
+static void* _merge_worker_main(void* i_merger)
+{
+	_merge_windows(*(timeline_merger_t*)i_merger);
+	return nullptr;
+}
+
+static void _start_workers(timeline_merger_t& io_merger, void* (*i_main)(void*))
+{
+	io_merger.next_window.store(0, std::memory_order_relaxed);
+	io_merger.running_workers_count = 0;
+	for (u32 i = 0; i < io_merger.workers_count; i++) {
+		if (pthread_create(&io_merger.workers[io_merger.running_workers_count], nullptr, i_main, &io_merger) == 0) {
+			io_merger.running_workers_count++;
+		}
+	}
+}
+#endif
+
+static void _join_workers(timeline_merger_t& io_merger)
+{
+#if defined(PLATFORM_POSIX)
+	for (u32 i = 0; i < io_merger.running_workers_count; i++) {
+		pthread_join(io_merger.workers[i], nullptr);
+	}
+#endif
+	io_merger.running_workers_count = 0;
+}
+
+// -----------------------------------------
+timeline_merger_t* create_timeline_merger(const u32 i_workersCount, const u32 i_batchSize)
+{
+	timeline_merger_t* merger = nullptr;
+	{
+		floral::lock_guard initGuard(detail::s_init_mtx);
+		merger = e_main_allocator.allocate<timeline_merger_t>();
+		merger->events = e_main_allocator.allocate_array<unpacked_event>(MERGE_EVENTS_CAP);
+		merger->keys = e_main_allocator.allocate_array<timeline_key_t>(MERGE_EVENTS_CAP);
+		merger->output = e_main_allocator.allocate_array<merged_event_t>(MERGE_EVENTS_CAP);
+	}
+	merger->streams_count = 0;
+	merger->events_count = 0;
+	merger->windows_count = 0;
+	merger->next_window.store(0, std::memory_order_relaxed);
+	merger->emit_window = 0;
+	merger->emit_offset = 0;
+	merger->epoch = detail::read_clock();
+	merger->batch_size = i_batchSize > 0 ? i_batchSize : 1;
+	merger->workers_count = i_workersCount < MERGE_WORKERS_CAP ? i_workersCount : MERGE_WORKERS_CAP;
+	merger->running_workers_count = 0;
+	return merger;
+}
+
+const u32 begin_timeline_merge(timeline_merger_t& io_merger)
+{
+	// the previous merge may not have been read to the end
+	_join_workers(io_merger);
+
+	io_merger.streams_count = 0;
+	io_merger.events_count = 0;
+	const u32 slotsCount = get_thread_slots_count();
+	// once the storage is full the remaining events stay in their slots for the next merge
+	for (u32 i = 0; i < slotsCount && io_merger.events_count < MERGE_EVENTS_CAP; i++) {
+		timeline_stream_t& stream = io_merger.streams[io_merger.streams_count];
+		stream.thread_slot = i;
+		stream.begin = io_merger.events_count;
+		visit_capture((sidx)i, [&io_merger](const unpacked_event& i_event) {
+			const u32 eventIdx = io_merger.events_count++;
+			io_merger.events[eventIdx] = i_event;
+			io_merger.keys[eventIdx].time_stamp = i_event.time_stamp;
+			io_merger.keys[eventIdx].event_idx = eventIdx;
+		}, MERGE_EVENTS_CAP - io_merger.events_count);
+		stream.end = io_merger.events_count;
+		if (stream.end > stream.begin) {
+			io_merger.streams_count++;
+		}
+	}
+
+	const u32 eventsCount = io_merger.events_count;
+	bool parallel = false;
+#if defined(PLATFORM_POSIX)
+	parallel = io_merger.workers_count > 0 && eventsCount >= MERGE_PARALLEL_EVENTS;
+#endif
+
+	// windows of about one batch, the time stamps of the splits are found by bisection
+	u32 windowsCount = 1;
+	if (parallel) {
+		windowsCount = (eventsCount + io_merger.batch_size - 1) / io_merger.batch_size;
+		windowsCount = windowsCount < MERGE_WINDOWS_CAP ? windowsCount : MERGE_WINDOWS_CAP;
+#if defined(PLATFORM_POSIX)
+		_start_workers(io_merger, &_sort_worker_main);
+		_sort_streams(io_merger);
+		_join_workers(io_merger);
+#endif
+	} else {
+		for (u32 i = 0; i < io_merger.streams_count; i++) {
+			const timeline_stream_t& stream = io_merger.streams[i];
+			_sort_stream(io_merger.keys + stream.begin, stream.end - stream.begin);
+		}
+	}
+
+	u64 minTimeStamp = ~0ull;
+	u64 maxTimeStamp = 0;
+	for (u32 i = 0; i < io_merger.streams_count; i++) {
+		const timeline_stream_t& stream = io_merger.streams[i];
+		const u64 first = io_merger.keys[stream.begin].time_stamp;
+		const u64 last = io_merger.keys[stream.end - 1].time_stamp;
+		minTimeStamp = first < minTimeStamp ? first : minTimeStamp;
+		maxTimeStamp = last > maxTimeStamp ? last : maxTimeStamp;
+	}
+
+	io_merger.windows_count = 0;
+	for (u32 w = 0; w < windowsCount; w++) {
+		u64 beginTimeStamp = minTimeStamp;
+		if (w > 0) {
+			// smallest time stamp with at least w / windowsCount of the events before it
+			const u32 target = (u32)((u64)eventsCount * w / windowsCount);
+			u64 lo = io_merger.windows[io_merger.windows_count - 1].begin_time_stamp;
+			u64 hi = maxTimeStamp;
+			while (lo < hi) {
+				const u64 mid = lo + (hi - lo) / 2;
+				if (_count_before(io_merger, mid) < target) {
+					lo = mid + 1;
+				} else {
+					hi = mid;
+				}
+			}
+			beginTimeStamp = lo;
+			if (beginTimeStamp == io_merger.windows[io_merger.windows_count - 1].begin_time_stamp) {
+				// a run of equal time stamps, the previous window takes it
+				continue;
+			}
+		}
+		timeline_window_t& window = io_merger.windows[io_merger.windows_count++];
+		window.begin_time_stamp = beginTimeStamp;
+		window.output_offset = w == 0 ? 0 : _count_before(io_merger, beginTimeStamp);
+		window.done.store(0, std::memory_order_relaxed);
+	}
+	for (u32 w = 0; w < io_merger.windows_count; w++) {
+		const u32 end = w + 1 < io_merger.windows_count ? io_merger.windows[w + 1].output_offset : eventsCount;
+		io_merger.windows[w].count = end - io_merger.windows[w].output_offset;
+	}
+	io_merger.emit_window = 0;
+	io_merger.emit_offset = 0;
+
+	if (parallel) {
+#if defined(PLATFORM_POSIX)
+		_start_workers(io_merger, &_merge_worker_main);
+#endif
+	} else {
+		for (u32 w = 0; w < io_merger.windows_count; w++) {
+			_merge_window(io_merger, w);
+		}
+	}
+	return eventsCount;
+}
+
+const u32 next_timeline_batch(timeline_merger_t& io_merger, const merged_event_t*& o_events)
+{
+	while (io_merger.emit_window < io_merger.windows_count
+			&& io_merger.emit_offset == io_merger.windows[io_merger.emit_window].count) {
+		io_merger.emit_window++;
+		io_merger.emit_offset = 0;
+	}
+	if (io_merger.emit_window == io_merger.windows_count) {
+		_join_workers(io_merger);
+		return 0;
+	}
+
+	timeline_window_t& window = io_merger.windows[io_merger.emit_window];
+	if (window.done.load(std::memory_order_acquire) == 0) {
+		// the calling thread helps instead of waiting when a window was not claimed yet
+		const u32 windowIdx = io_merger.next_window.fetch_add(1, std::memory_order_relaxed);
+		if (windowIdx < io_merger.windows_count) {
+			_merge_window(io_merger, windowIdx);
+		}
+		while (window.done.load(std::memory_order_acquire) == 0) {
+#if defined(PLATFORM_POSIX)
+			sched_yield();
+#endif
+		}
+	}
+
+	const u32 remaining = window.count - io_merger.emit_offset;
+	const u32 count = remaining < io_merger.batch_size ? remaining : io_merger.batch_size;
+	o_events = io_merger.output + window.output_offset + io_merger.emit_offset;
+	io_merger.emit_offset += count;
+	return count;
+}
+
+}
@@ -0,0 +1,250 @@
+#include "lotus/trigger.h"
+
+#include "lotus/profiler.h"
+#include "lotus/detail/profiler.h"
+#include "lotus/detail/trigger.h"
+#include "lotus/detail/gpu_sampler.h"
+
+#include <floral/thread/mutex.h>
+
+namespace lotus
+{
+
+namespace detail
+{
+	std::atomic<u32>							s_trigger_name_id(k_invalid_name_id);
+	std::atomic<u64>							s_trigger_threshold_ticks(~0ull);
+	std::atomic<u64>							s_trigger_pin_begin(0);
+	std::atomic<u64>							s_trigger_pin_end(0);
+}
+
+struct trigger_t
+{
+	std::atomic<u32>							state;
+	std::atomic<u32>							missed_count;
+	bool										armed;									// guarded by s_trigger_mtx
+	u64											window_ticks;
+	u32											window_ms;
+
+	// written by the firing thread between trigger_state_e::firing and trigger_state_e::fired
+	u64											fire_time_stamp;
+	u32											fire_name_id;
+	u64											fire_duration_ticks;
+};
+
+static trigger_t								s_trigger;
+static trigger_dump_t*							s_trigger_dump = nullptr;
+static floral::mutex							s_trigger_mtx;
+
+static u8										s_dump_block_data[sizeof(detail::compact_block_t::data)];	// guarded by s_trigger_mtx
+
+static const bool _is_in_window(const unpacked_event& i_event, const u64 i_windowBegin, const u64 i_windowEnd)
+{
+	return i_event.time_stamp <= i_windowEnd && i_event.time_stamp + i_event.duration_ticks >= i_windowBegin;
+}
+
+// copies the events of a fixed ring overlapping the window, in begin order. Every readable slot
+// is looked at: a long scope reserved well before the window still overlaps it.
+static void _dump_fixed_events(trigger_dump_t& io_dump, const detail::unpacked_event_buffer_t& i_buffer,
+		const u64 i_windowBegin, const u64 i_windowEnd)
+{
+	const u64 wpos = i_buffer.widx.load(std::memory_order_acquire);
+	const u64 oldestPos = wpos > EVENTS_CAP ? wpos - EVENTS_CAP : 0;
+	for (u64 pos = oldestPos; pos < wpos && io_dump.events_count < TRIGGER_DUMP_EVENTS_CAP; pos++)
+	{
+		// scopes still open and slots reused meanwhile are not readable
+		unpacked_event& eve = io_dump.events[io_dump.events_count];
+		if (detail::read_event(i_buffer, pos, eve) && _is_in_window(eve, i_windowBegin, i_windowEnd))
+		{
+			io_dump.events_count++;
+		}
+	}
+}
+
+// copies the events of a compact block ring overlapping the window, in completion order. Every
+// block still in the ring is looked at, consumed or not, without moving the consumer position:
+// a block is copied first and decoded only if the producer did not start to reuse it meanwhile.
+static void _dump_compact_events(trigger_dump_t& io_dump, const detail::compact_event_buffer_t& i_buffer,
+		const u64 i_windowBegin, const u64 i_windowEnd)
+{
+	auto appendInWindow = [&io_dump, i_windowBegin, i_windowEnd](const unpacked_event& i_event) {
+		if (io_dump.events_count < TRIGGER_DUMP_EVENTS_CAP && _is_in_window(i_event, i_windowBegin, i_windowEnd))
+		{
+			io_dump.events[io_dump.events_count++] = i_event;
+		}
+	};
+
+	const u64 wblock = i_buffer.wblock.load(std::memory_order_acquire);
+	const u64 oldestBlock = wblock >= COMPACT_BLOCKS_CAP ? wblock - (COMPACT_BLOCKS_CAP - 1) : 0;
+	for (u64 b = oldestBlock; b <= wblock; b++)
+	{
+		const detail::compact_block_t& block = i_buffer.blocks[b & (COMPACT_BLOCKS_CAP - 1)];
+		const u32 committed = block.committed.load(std::memory_order_acquire);
+		const u64 baseTimeStamp = block.base_time_stamp;
+		memcpy(s_dump_block_data, block.data, committed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (i_buffer.wblock.load(std::memory_order_relaxed) - b >= COMPACT_BLOCKS_CAP)
+		{
+			continue;
+		}
+		detail::visit_compact_block(s_dump_block_data, committed, baseTimeStamp, appendInWindow);
+	}
+}
+
+// insertion sort on (time stamp, depth): completion order only leaves each scope behind the
+// scopes it encloses
+static void _sort_in_begin_order(unpacked_event* io_events, const u32 i_count)
+{
+	for (u32 i = 1; i < i_count; i++)
+	{
+		const unpacked_event eve = io_events[i];
+		u32 j = i;
+		for (; j > 0 && (io_events[j - 1].time_stamp > eve.time_stamp
+				|| (io_events[j - 1].time_stamp == eve.time_stamp && io_events[j - 1].depth > eve.depth)); j--)
+		{
+			io_events[j] = io_events[j - 1];
+		}
+		io_events[j] = eve;
+	}
+}
+
+// the producer does not reuse the slots or blocks of the window while it is pinned
+static void _dump_thread_slot(trigger_dump_t& io_dump, const u32 i_slotIdx, const detail::thread_slot_t* i_threadSlot,
+		const u64 i_windowBegin, const u64 i_windowEnd)
+{
+	trigger_dump_thread_t& dumpThread = io_dump.threads[io_dump.threads_count];
+	dumpThread.slot_idx = i_slotIdx;
+	dumpThread.thread_id = i_threadSlot->thread_id;
+	strcpy(dumpThread.name, i_threadSlot->name);
+	dumpThread.first_event = io_dump.events_count;
+	if (i_threadSlot->buffer.storage_mode == storage_mode_e::compact)
+	{
+		_dump_compact_events(io_dump, i_threadSlot->buffer.compact, i_windowBegin, i_windowEnd);
+		_sort_in_begin_order(io_dump.events + dumpThread.first_event, io_dump.events_count - dumpThread.first_event);
+	}
+	else
+	{
+		_dump_fixed_events(io_dump, i_threadSlot->buffer, i_windowBegin, i_windowEnd);
+	}
+	dumpThread.events_count = io_dump.events_count - dumpThread.first_event;
+	io_dump.threads_count++;
+}
+
+namespace detail
+{
+void fire_trigger(const u32 i_nameId, const u64 i_timeStamp, const u64 i_durationTicks)
+{
+	u32 state = (u32)detail::trigger_state_e::armed;
+	if (!s_trigger.state.compare_exchange_strong(state, (u32)detail::trigger_state_e::firing, std::memory_order_acquire))
+	{
+		if (state != (u32)detail::trigger_state_e::disarmed)
+		{
+			s_trigger.missed_count.fetch_add(1, std::memory_order_relaxed);
+		}
+		return;
+	}
+
+	s_trigger.fire_time_stamp = i_timeStamp;
+	s_trigger.fire_name_id = i_nameId;
+	s_trigger.fire_duration_ticks = i_durationTicks;
+
+	// the copy is left to process_trigger, the producers keep the window until then
+	const u64 windowBegin = i_timeStamp > s_trigger.window_ticks ? i_timeStamp - s_trigger.window_ticks : 0;
+	detail::s_trigger_pin_begin.store(windowBegin, std::memory_order_relaxed);
+	detail::s_trigger_pin_end.store(i_timeStamp, std::memory_order_release);
+
+	s_trigger.state.store((u32)detail::trigger_state_e::fired, std::memory_order_release);
+}
+}
+
+void arm_trigger(const u32 i_nameId, const f64 i_thresholdMs, const u32 i_windowMs)
+{
+	floral::lock_guard triggerGuard(s_trigger_mtx);
+	if (s_trigger_dump == nullptr)
+	{
+		floral::lock_guard initGuard(detail::s_init_mtx);
+		s_trigger_dump = e_main_allocator.allocate<trigger_dump_t>();
+		s_trigger_dump->events = e_main_allocator.allocate_array<unpacked_event>(TRIGGER_DUMP_EVENTS_CAP);
+		s_trigger_dump->gpu_samples = e_main_allocator.allocate_array<gpu_counters_sample_t>(GPU_SAMPLES_CAP);
+	}
+
+	const u64 frequency = get_clock_info().frequency;
+	s_trigger.window_ms = i_windowMs;
+	s_trigger.window_ticks = frequency * i_windowMs / 1000;
+	detail::s_trigger_threshold_ticks.store((u64)(i_thresholdMs * (f64)frequency / 1000.0), std::memory_order_relaxed);
+	detail::s_trigger_name_id.store(i_nameId, std::memory_order_relaxed);
+
+	// a pending or held dump keeps its state, release_trigger_dump re-arms
+	s_trigger.armed = true;
+	u32 state = (u32)detail::trigger_state_e::disarmed;
+	s_trigger.state.compare_exchange_strong(state, (u32)detail::trigger_state_e::armed, std::memory_order_release);
+}
+
+void disarm_trigger()
+{
+	floral::lock_guard triggerGuard(s_trigger_mtx);
+	detail::s_trigger_name_id.store(k_invalid_name_id, std::memory_order_relaxed);
+	s_trigger.armed = false;
+	u32 state = (u32)detail::trigger_state_e::armed;
+	s_trigger.state.compare_exchange_strong(state, (u32)detail::trigger_state_e::disarmed, std::memory_order_release);
+}
+
+void fire_trigger()
+{
+	const u64 timeStamp = detail::read_clock();
+	detail::fire_trigger(k_invalid_name_id, timeStamp, 0);
+}
+
+const trigger_dump_t* process_trigger()
+{
+	floral::lock_guard triggerGuard(s_trigger_mtx);
+	if (s_trigger.state.load(std::memory_order_acquire) != (u32)detail::trigger_state_e::fired)
+	{
+		return nullptr;
+	}
+
+	trigger_dump_t& dump = *s_trigger_dump;
+	dump.fire_time_stamp = s_trigger.fire_time_stamp;
+	dump.name_id = s_trigger.fire_name_id;
+	dump.duration_ms = ticks_to_ms(s_trigger.fire_duration_ticks);
+	dump.window_ms = (f64)s_trigger.window_ms;
+	dump.threads_count = 0;
+	dump.events_count = 0;
+
+	const u64 windowBegin = detail::s_trigger_pin_begin.load(std::memory_order_relaxed);
+	const u64 windowEnd = s_trigger.fire_time_stamp;
+	const u32 slotsCount = detail::s_thread_slots_count.load(std::memory_order_acquire);
+	for (u32 i = 0; i < slotsCount; i++)
+	{
+		const detail::thread_slot_t* threadSlot = detail::get_thread_slot(i);
+		const u32 slotState = threadSlot->state.load(std::memory_order_acquire);
+		if (slotState == (u32)detail::thread_slot_state_e::free || threadSlot->buffer.storage_mode == storage_mode_e::none)
+		{
+			continue;
+		}
+		_dump_thread_slot(dump, i, threadSlot, windowBegin, windowEnd);
+	}
+
+	dump.gpu_samples_count = detail::peek_gpu_samples(windowBegin, windowEnd, dump.gpu_samples, GPU_SAMPLES_CAP);
+
+	// copied, the producers may reuse the slots of the window again
+	detail::s_trigger_pin_end.store(0, std::memory_order_release);
+	s_trigger.state.store((u32)detail::trigger_state_e::dumped, std::memory_order_release);
+	return &dump;
+}
+
+void release_trigger_dump()
+{
+	floral::lock_guard triggerGuard(s_trigger_mtx);
+	u32 state = (u32)detail::trigger_state_e::dumped;
+	s_trigger.state.compare_exchange_strong(state,
+			(u32)(s_trigger.armed ? detail::trigger_state_e::armed : detail::trigger_state_e::disarmed),
+			std::memory_order_release);
+}
+
+const u32 get_missed_triggers_count()
+{
+	return s_trigger.missed_count.load(std::memory_order_relaxed);
+}
+
+}
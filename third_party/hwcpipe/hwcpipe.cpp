@@ -25,4 +25,19 @@ void sample()
 	sample_mali_profiler();
 }
 
+uint64_t get_sample_time_stamp()
+{
+	return get_mali_sample_time_stamp();
+}
+
+void use_recorded_dumps(const char* i_path)
+{
+	set_mali_replay_file(i_path);
+}
+
+void record_dumps(const char* i_path)
+{
+	set_mali_record_file(i_path);
+}
+
 }
@@ -2,6 +2,7 @@
 
 #include "gpu_profiler.h"
 
+#include <cstddef>
 #include <cstdint>
 
 namespace hwcpipe
@@ -12,6 +13,15 @@ const bool										initialize_gpu_counters(gpu_counter_e* i_enabledCounters, co
 void											start();
 void											stop();
 void											sample();
+// time stamp of the last sample, as reported by the driver
+uint64_t										get_sample_time_stamp();
+
+// both must be called before initialize_gpu_counters, pass nullptr to turn them off.
+// Replay: dumps recorded on a device are read from a file instead of /dev/mali0 and
+// played back in a loop, the rest of the pipeline is unchanged.
+void											use_recorded_dumps(const char* i_path);
+// Record: on device, every dump is also appended to a file that use_recorded_dumps can read.
+void											record_dumps(const char* i_path);
 
 uint64_t										get_counter_value(const gpu_counter_e i_counter);
 
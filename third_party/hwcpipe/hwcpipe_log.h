@@ -32,10 +32,13 @@
 #	define HWCPIPE_LOG(...) __android_log_print(ANDROID_LOG_VERBOSE, HWCPIPE_TAG, __VA_ARGS__)
 #	define HWCPIPE_INFO(...) __android_log_print(ANDROID_LOG_INFO, HWCPIPE_TAG, __VA_ARGS__)
 #else
+#	include <cstdio>
+
 #	define HWCPIPE_LOG(...)                              \
 		{                                                 \
-			fprintf(stdout, "%s [INFO] : ", HWCPIPE_TAG); \
-			fprintf(stdout, __VA_ARGS__);                 \
-			fprintf(stdout, "\n");                        \
+			fprintf(stderr, "%s [INFO] : ", HWCPIPE_TAG); \
+			fprintf(stderr, __VA_ARGS__);                 \
+			fprintf(stderr, "\n");                        \
 		}
+#	define HWCPIPE_INFO(...) HWCPIPE_LOG(__VA_ARGS__)
 #endif